@@ -0,0 +1,385 @@
+#ifndef ASSEMBLER_POOL_HPP
+#define ASSEMBLER_POOL_HPP
+
+//Includes
+#include <spawn.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Own includes
+#include "configParam.hpp"
+#include "configPath.hpp"
+#include "assemblyLedger.hpp"
+
+extern char **environ;
+
+/*
+ * FILE SYSTEM HELPERS, used instead of shell commands during assembly
+ */
+
+//Creates the directory along with missing parents, same as mkdir -p
+inline void makeDirectory(const std::string& path)
+{
+  for(std::size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1))
+  {
+    std::string prefix = path.substr(0, pos);
+    if(!prefix.empty())
+      mkdir(prefix.c_str(), 0755);
+
+    if(pos == std::string::npos)
+      break;
+  }
+}
+
+//Removes everything inside the directory, same as rm -rf path/*
+inline void removeDirectoryContents(const std::string& path)
+{
+  DIR* dir = opendir(path.c_str());
+  if(dir == nullptr)
+    return;
+
+  while(struct dirent* entry = readdir(dir))
+  {
+    if(std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0)
+      continue;
+
+    std::string entryPath = path + "/" + entry->d_name;
+    struct stat st;
+    if(lstat(entryPath.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+    {
+      removeDirectoryContents(entryPath);
+      rmdir(entryPath.c_str());
+    }
+    else
+      unlink(entryPath.c_str());
+  }
+
+  closedir(dir);
+}
+
+//Removes the directory and its contents, same as rm -rf path
+inline void removeDirectory(const std::string& path)
+{
+  removeDirectoryContents(path);
+  rmdir(path.c_str());
+}
+
+//Appends the contents of file to the stream, missing file is ignored
+inline void appendFile(const std::string& filename, std::ofstream& ofs)
+{
+  std::ifstream ifs(filename, std::ios_base::binary);
+  if(ifs.good() && ifs.peek() != std::ifstream::traits_type::eof())
+    ofs << ifs.rdbuf();
+}
+
+/*
+ * @brief     Runs assembler jobs concurrently on this rank, each in its own scratch directory
+ * @details   A job runs velveth and then velvetg, started with posix_spawn without a shell.
+ *            Contigs of a finished job are appended to this rank's contig file, and its
+ *            scratch directory is cleaned in-process.
+ *            Jobs with small input run in memFS and larger ones on localFS, so that most jobs
+ *            never touch the disk. memFS taken by the jobs of this rank is capped, see MEMFS_BYTES_PER_RANK.
+ *            With a ledger, the pids of a job are recorded once its contigs are appended.
+ *            Usage : slot = acquireSlot(), write the reads to prepareInput(slot, bytes), launch(slot, pids)
+ *                    or release(slot), and finally waitAll(). Call poll() now and then while doing other work
+ */
+class AssemblerPool
+{
+  private:
+
+    //Stages of a slot's job
+    enum class Stage { idle, reserved, velveth, velvetg };
+
+    struct Slot
+    {
+      //Paths on local disk and memory backed file system
+      std::string diskReadsFile, diskOutputDir, memReadsFile, memOutputDir;
+
+      //Paths of the current job
+      std::string readsFile, outputDir;
+      std::vector<PidType> pids;
+      pid_t pid;
+      Stage stage;
+
+      //memFS bytes charged for the current job
+      uint64_t memFSBytes;
+    };
+
+    std::vector<Slot> slots;
+    std::string velvethExe, velvetgExe, velvetKmerSize, contigFile;
+    AssemblyLedger* ledger;
+    int busySlots;
+    int jobsCompleted;
+    bool memFSAvailable;
+
+    //memFS bytes charged for the jobs of all the slots, kept within MEMFS_BYTES_PER_RANK
+    uint64_t memFSBytesInUse;
+
+    //Returns the memFS bytes charged for the slot's job
+    void releaseMemFS(Slot& slot)
+    {
+      memFSBytesInUse -= slot.memFSBytes;
+      slot.memFSBytes = 0;
+    }
+
+    //Starts the executable with given arguments, returns -1 on failure
+    pid_t spawn(const std::string& exe, std::vector<std::string> args)
+    {
+      std::vector<char*> argv;
+      argv.push_back(const_cast<char*>(exe.c_str()));
+      for(auto& arg : args)
+        argv.push_back(&arg[0]);
+      argv.push_back(nullptr);
+
+      pid_t pid;
+      int err = posix_spawn(&pid, exe.c_str(), nullptr, nullptr, argv.data(), environ);
+      if(err != 0)
+      {
+        std::cerr << "Failed to start " << exe << " : " << std::strerror(err) << "\n";
+        return -1;
+      }
+
+      return pid;
+    }
+
+    //Starts the next stage of the job in the slot, or finishes the job
+    void advance(Slot& slot, bool succeeded)
+    {
+      if(slot.stage == Stage::velveth && succeeded)
+      {
+        slot.pid = spawn(velvetgExe, {slot.outputDir});
+        slot.stage = Stage::velvetg;
+        if(slot.pid != -1)
+          return;
+      }
+      else if(slot.stage == Stage::velvetg && succeeded)
+      {
+        uint64_t offset = ledger ? ledger->contigBytes() : 0;
+
+        std::ofstream ofs(contigFile, std::ios_base::app | std::ios_base::binary);
+        appendFile(slot.outputDir + "/contigs.fa", ofs);
+        ofs.close();
+
+        if(ledger)
+          ledger->record(slot.pids, offset, ledger->contigBytes() - offset);
+      }
+
+      removeDirectoryContents(slot.outputDir);
+
+      //Free the memory held by input as well
+      if(slot.readsFile == slot.memReadsFile)
+        unlink(slot.readsFile.c_str());
+      releaseMemFS(slot);
+
+      slot.stage = Stage::idle;
+      busySlots--;
+      jobsCompleted++;
+    }
+
+    int runningJobs() const
+    {
+      int count = 0;
+      for(auto& slot : slots)
+        if(slot.stage == Stage::velveth || slot.stage == Stage::velvetg)
+          count++;
+      return count;
+    }
+
+    //Handles exit of one of the running processes, returns false if none exited
+    //Blocks until a process exits unless told otherwise.
+    //Only the processes of the slots are waited for, children started by MPI or libraries are left alone
+    bool reapOne(bool block = true)
+    {
+      while(true)
+      {
+        for(auto& slot : slots)
+        {
+          if(slot.stage != Stage::velveth && slot.stage != Stage::velvetg)
+            continue;
+
+          int status;
+          pid_t pid = waitpid(slot.pid, &status, WNOHANG);
+
+          if(pid == 0 || (pid == -1 && errno == EINTR))
+            continue;
+
+          //A process reaped elsewhere (pid == -1) counts as failed, its result is unknown
+          bool succeeded = (pid == slot.pid) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+          if(!succeeded)
+            std::cerr << "Assembler failed in " << slot.outputDir << "\n";
+
+          advance(slot, succeeded);
+          return true;
+        }
+
+        if(!block || runningJobs() == 0)
+          return false;
+
+        //Jobs take seconds, checking every millisecond costs nothing
+        usleep(1000);
+      }
+    }
+
+  public:
+
+    /*
+     * @param[in] contigFile_     Contigs of all the jobs are appended to this file
+     * @param[in] concurrency     Maximum count of jobs running together
+     * @param[in] ledger_         Records the partitions of finished jobs if not null, its contig file should be contigFile_
+     */
+    AssemblerPool(int rank, const cmdLineParams &cmdLineVals, const std::string& contigFile_, int concurrency,
+                  AssemblyLedger* ledger_ = nullptr)
+      : slots(std::max(concurrency, 1)), ledger(ledger_), busySlots(0), jobsCompleted(0), memFSBytesInUse(0)
+    {
+      velvethExe = projSrcDir + "/ext/velvet/velveth";
+      velvetgExe = projSrcDir + "/ext/velvet/velvetg";
+      velvetKmerSize = std::to_string(cmdLineVals.velvetKmerSize);
+      contigFile = contigFile_;
+      memFSAvailable = (access(memFS.c_str(), W_OK) == 0);
+
+      for(std::size_t i = 0; i < slots.size(); i++)
+      {
+        std::string suffix = std::to_string(rank) + "_" + std::to_string(i);
+        slots[i].diskReadsFile = localFS + "/reads_" + suffix + ".fasta";
+        slots[i].diskOutputDir = localFS + "/velvetOutput_" + suffix;
+        slots[i].memReadsFile = memFS + "/reads_" + suffix + ".fasta";
+        slots[i].memOutputDir = memFS + "/velvetOutput_" + suffix;
+        slots[i].readsFile = slots[i].diskReadsFile;
+        slots[i].outputDir = slots[i].diskOutputDir;
+        slots[i].pid = -1;
+        slots[i].stage = Stage::idle;
+        slots[i].memFSBytes = 0;
+
+        //Clean things in case output already exists
+        makeDirectory(slots[i].diskOutputDir);
+        removeDirectoryContents(slots[i].diskOutputDir);
+
+        if(memFSAvailable)
+        {
+          makeDirectory(slots[i].memOutputDir);
+          removeDirectoryContents(slots[i].memOutputDir);
+        }
+      }
+    }
+
+    ~AssemblerPool()
+    {
+      waitAll();
+
+      for(auto& slot : slots)
+      {
+        removeDirectory(slot.diskOutputDir);
+        unlink(slot.diskReadsFile.c_str());
+
+        if(memFSAvailable)
+        {
+          removeDirectory(slot.memOutputDir);
+          unlink(slot.memReadsFile.c_str());
+        }
+      }
+    }
+
+    //Reserves an idle slot, waits for a running job to finish if needed
+    int acquireSlot()
+    {
+      while(busySlots == (int)slots.size())
+        reapOne();
+
+      for(std::size_t i = 0; i < slots.size(); i++)
+      {
+        if(slots[i].stage == Stage::idle)
+        {
+          slots[i].stage = Stage::reserved;
+          busySlots++;
+          return i;
+        }
+      }
+
+      return -1;
+    }
+
+    //Returns a reserved slot without running a job
+    void release(int slotId)
+    {
+      releaseMemFS(slots[slotId]);
+      slots[slotId].stage = Stage::idle;
+      busySlots--;
+    }
+
+    /*
+     * @brief                   Chooses the file system for the next job in this slot
+     * @param[in] inputBytes    Estimated size of the fasta input
+     * @return                  File where reads of the job should be written
+     * @details                 memFS is used if the job is small and fits in what the other jobs leave of MEMFS_BYTES_PER_RANK
+     */
+    const std::string& prepareInput(int slotId, uint64_t inputBytes)
+    {
+      Slot& slot = slots[slotId];
+      releaseMemFS(slot);
+
+      uint64_t memFSBytes = inputBytes * MEMFS_BYTES_PER_INPUT_BYTE;
+      if(memFSAvailable && inputBytes <= MEMFS_INPUT_BYTES_THRESHOLD && memFSBytesInUse + memFSBytes <= MEMFS_BYTES_PER_RANK)
+      {
+        slot.readsFile = slot.memReadsFile;
+        slot.outputDir = slot.memOutputDir;
+        slot.memFSBytes = memFSBytes;
+        memFSBytesInUse += memFSBytes;
+      }
+      else
+      {
+        slot.readsFile = slot.diskReadsFile;
+        slot.outputDir = slot.diskOutputDir;
+      }
+
+      return slot.readsFile;
+    }
+
+    //Starts assembly of the reads in readsFile(slotId), which belong to the partitions pids
+    void launch(int slotId, const std::vector<PidType>& pids)
+    {
+      Slot& slot = slots[slotId];
+      slot.pids = pids;
+
+      slot.pid = spawn(velvethExe, {slot.outputDir, velvetKmerSize, "-short", slot.readsFile});
+      slot.stage = Stage::velveth;
+
+      if(slot.pid == -1)
+        advance(slot, false);
+    }
+
+    //Moves the jobs along without blocking, e.g. starts velvetg of jobs whose velveth finished
+    void poll()
+    {
+      while(runningJobs() > 0 && reapOne(false));
+    }
+
+    //Count of slots ready for a new job, without waiting
+    int idleSlots() const
+    {
+      return slots.size() - busySlots;
+    }
+
+    //Waits for all the launched jobs to finish
+    void waitAll()
+    {
+      while(runningJobs() > 0)
+        reapOne();
+    }
+
+    //Count of jobs finished so far
+    int completed() const
+    {
+      return jobsCompleted;
+    }
+};
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef ASSEMBLY_LEDGER_HPP
+#define ASSEMBLY_LEDGER_HPP
+
+//Includes
+#include <mpi.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Own includes
+#include "configParam.hpp"
+
+/*
+ * @brief     Append-only record of the partitions assembled so far, for resuming an interrupted assembly phase
+ * @details   Every run is a generation g. Rank r of the run appends its contigs to <dir>/contigs_<g>_<r>.fasta
+ *            and, after the contigs of some partitions are appended, an entry (pid, contig offset, contig bytes,
+ *            count of partitions) per partition to <dir>/ledger_<g>_<r>.bin. All fields are 64 bit integers.
+ *            Partitions assembled together share their contigs, so their entries are written at once and
+ *            a group cut short by a crash counts as unfinished.
+ *            A fresh run clears the directory. A resumed run reads the ledgers of all earlier generations:
+ *            their partitions are complete, and the contigs of an earlier file are valid up to the end of its
+ *            last recorded contigs. Contigs appended after the last entry belong to unfinished partitions
+ *            and are left out.
+ *            The directory should be visible to all the ranks when ranks may run on other nodes after restart,
+ *            it is created if its parent exists
+ */
+class AssemblyLedger
+{
+  private:
+
+    std::string dir;
+    int rank, generation;
+    std::string ledgerFile, contigFile_;
+
+    //Pids recorded by earlier generations, sorted
+    std::vector<PidType> completedPids;
+
+    //Pairs of <Contig file of an earlier generation, valid bytes> merged by this rank
+    std::vector<std::pair<std::string, uint64_t>> previousFiles;
+
+    //Generation and rank from a ledger file name, false if the name doesn't match
+    static bool parseLedgerName(const std::string& name, int& g, int& r)
+    {
+      char tail;
+      return std::sscanf(name.c_str(), "ledger_%d_%d.bi%c", &g, &r, &tail) == 3 && tail == 'n';
+    }
+
+    std::string ledgerName(int g, int r) const
+    {
+      return dir + "/ledger_" + std::to_string(g) + "_" + std::to_string(r) + ".bin";
+    }
+
+    std::string contigName(int g, int r) const
+    {
+      return dir + "/contigs_" + std::to_string(g) + "_" + std::to_string(r) + ".fasta";
+    }
+
+    //Removes ledgers and contig files of earlier generations, other files stay
+    void clear() const
+    {
+      DIR* d = opendir(dir.c_str());
+      if(d == nullptr)
+        return;
+
+      while(struct dirent* entry = readdir(d))
+      {
+        int g, r;
+        char tail;
+        if(parseLedgerName(entry->d_name, g, r)
+            || (std::sscanf(entry->d_name, "contigs_%d_%d.fast%c", &g, &r, &tail) == 3 && tail == 'a'))
+          unlink((dir + "/" + entry->d_name).c_str());
+      }
+      closedir(d);
+    }
+
+    //Pairs of <generation, rank> of the ledgers in the directory, sorted
+    std::vector<std::pair<int, int>> listLedgers() const
+    {
+      std::vector<std::pair<int, int>> ledgers;
+
+      DIR* d = opendir(dir.c_str());
+      if(d == nullptr)
+        return ledgers;
+
+      while(struct dirent* entry = readdir(d))
+      {
+        int g, r;
+        if(parseLedgerName(entry->d_name, g, r))
+          ledgers.emplace_back(g, r);
+      }
+      closedir(d);
+
+      std::sort(ledgers.begin(), ledgers.end());
+      return ledgers;
+    }
+
+  public:
+
+    /*
+     * @param[in] resume    If false, earlier ledgers and contigs in dir are removed
+     * @details             Collective
+     */
+    AssemblyLedger(const std::string& dir_, bool resume, MPI_Comm comm = MPI_COMM_WORLD)
+      : dir(dir_), generation(0)
+    {
+      int p;
+      MPI_Comm_rank(comm, &rank);
+      MPI_Comm_size(comm, &p);
+
+      if(!rank)
+      {
+        mkdir(dir.c_str(), 0755);
+        if(!resume)
+          clear();
+      }
+      MPI_Barrier(comm);
+
+      auto ledgers = listLedgers();
+      if(!ledgers.empty())
+        generation = ledgers.back().first + 1;
+
+      //Every rank should see the same listing, new files are created only after everyone listed
+      int minGeneration = generation;
+      MPI_Allreduce(&generation, &minGeneration, 1, MPI_INT, MPI_MIN, comm);
+      if(minGeneration != generation)
+      {
+        if(!rank) std::cerr << "Ledger directory " << dir << " is not shared by all the ranks\n";
+        MPI_Abort(comm, 1);
+      }
+
+      for(std::size_t i = 0; i < ledgers.size(); i++)
+      {
+        std::ifstream ifs(ledgerName(ledgers[i].first, ledgers[i].second), std::ios_base::binary);
+
+        //Entries of a group are valid only if all of them are present
+        uint64_t entry[4], validBytes = 0;
+        std::vector<PidType> group;
+        while(ifs.read(reinterpret_cast<char*>(entry), sizeof(entry)))
+        {
+          group.push_back(entry[0]);
+          if(group.size() == entry[3])
+          {
+            completedPids.insert(completedPids.end(), group.begin(), group.end());
+            validBytes = std::max(validBytes, entry[1] + entry[2]);
+            group.clear();
+          }
+        }
+
+        if(i % p == (std::size_t)rank)
+          previousFiles.emplace_back(contigName(ledgers[i].first, ledgers[i].second), validBytes);
+      }
+
+      std::sort(completedPids.begin(), completedPids.end());
+      completedPids.erase(std::unique(completedPids.begin(), completedPids.end()), completedPids.end());
+
+      ledgerFile = ledgerName(generation, rank);
+      contigFile_ = contigName(generation, rank);
+
+      std::ofstream(ledgerFile, std::ofstream::out | std::ofstream::binary).close();
+      std::ofstream(contigFile_, std::ofstream::out | std::ofstream::binary).close();
+    }
+
+    //File where this rank appends its contigs
+    const std::string& contigFile() const
+    {
+      return contigFile_;
+    }
+
+    //True if an earlier generation assembled the partition
+    bool completed(PidType pid) const
+    {
+      return std::binary_search(completedPids.begin(), completedPids.end(), pid);
+    }
+
+    std::size_t completedCount() const
+    {
+      return completedPids.size();
+    }
+
+    //Contig files of earlier generations this rank should merge, with their valid byte counts
+    const std::vector<std::pair<std::string, uint64_t>>& previousContigs() const
+    {
+      return previousFiles;
+    }
+
+    //Byte count of the contig file, taken before appending new contigs
+    uint64_t contigBytes() const
+    {
+      struct stat st;
+      return (stat(contigFile_.c_str(), &st) == 0) ? st.st_size : 0;
+    }
+
+    /*
+     * @brief               Records the partitions whose contigs were appended, call after the contigs are written
+     * @param[in] offset    Byte count of the contig file before the append
+     * @param[in] bytes     Bytes appended for all these partitions together
+     */
+    void record(const std::vector<PidType>& pids, uint64_t offset, uint64_t bytes)
+    {
+      if(pids.empty())
+        return;
+
+      std::vector<uint64_t> entries;
+      entries.reserve(4 * pids.size());
+      for(auto pid : pids)
+      {
+        entries.push_back(pid);
+        entries.push_back(offset);
+        entries.push_back(bytes);
+        entries.push_back(pids.size());
+      }
+
+      std::ofstream ofs(ledgerFile, std::ios_base::app | std::ios_base::binary);
+      ofs.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(uint64_t));
+    }
+};
+
+#endif
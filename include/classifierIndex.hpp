@@ -0,0 +1,286 @@
+#ifndef CLASSIFIER_INDEX_HPP
+#define CLASSIFIER_INDEX_HPP
+
+//Includes
+#include <mpi.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+//Includes from mxx library
+#include <mxx/collective.hpp>
+#include <mxx/reduction.hpp>
+
+//Own includes
+#include "configParam.hpp"
+#include "partitionStore.hpp"
+#include "kmerIndex.hpp"
+
+/*
+ * CLASSIFIER INDEX, a compact read only (canonical kmer, pid) table for assigning reads of other samples
+ * to the partitions of a run
+ *
+ * Single file :
+ *   Header
+ *   Blocks       Runs of at most CLASSIFIER_INDEX_BLOCK_RECORDS records sorted by kmer. A block starts with the
+ *                varint count of its records, followed by a varint kmer gap and a varint pid per record.
+ *                The gap of the first record is taken from the first kmer of the block, so it is 0
+ *   Fence table  (first kmer, byte offset) of every block, in block order
+ * All the fixed size fields are 64 bit integers in the byte order of the writer. Varints keep 7 bits per byte,
+ * low bits first. Pids are the partition ids of the run after hashPartitionId(), same as in the partition store,
+ * the partition summaries and the listing of extractPartitions. Runs splitting the largest partition write no index,
+ * its pieces get their ids after the kmers are gone
+ */
+
+//Header at the beginning of the file
+struct ClassifierIndexHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t kmerLength;
+  uint64_t kmerCount;
+  uint64_t blockCount;
+
+  //Byte offset of the fence table
+  uint64_t fenceOffset;
+  uint64_t endianCheck;
+  char padding[16];
+};
+static_assert(sizeof(ClassifierIndexHeader) == 64, "Classifier index header should take 64 bytes");
+
+const char CLASSIFIER_INDEX_MAGIC[8] = {'M', 'E', 'T', 'A', 'G', 'C', 'I', '1'};
+const uint32_t CLASSIFIER_INDEX_VERSION = 1;
+
+//Pair of <first kmer, byte offset> of a block
+typedef std::pair<uint64_t, uint64_t> classifierFence_t;
+
+inline void appendVarint(std::vector<char>& buffer, uint64_t x)
+{
+  while(x >= 0x80)
+  {
+    buffer.push_back(char((x & 0x7f) | 0x80));
+    x >>= 7;
+  }
+  buffer.push_back(char(x));
+}
+
+//Decodes a varint at p and moves p past it
+inline uint64_t readVarint(const unsigned char*& p)
+{
+  uint64_t x = 0;
+  for(int shift = 0; ; shift += 7)
+  {
+    unsigned char byte = *p++;
+    x |= uint64_t(byte & 0x7f) << shift;
+    if(byte < 0x80)
+      return x;
+  }
+}
+
+/*
+ * @brief                 Writes the classifier index of the partitioning result, collective
+ * @param[in] localVector Kmer tuples after partitioning, without read tags
+ * @details               Every rank encodes the blocks of its own records, the blocks and then the fence
+ *                        table are written at offsets from prefix sums. Blocks don't cross ranks
+ */
+template <typename T>
+void writeClassifierIndex(const std::vector<T>& localVector, const std::string& filename, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  std::vector<kmerIndexRecord_t> records = collectKmerRecords(localVector, comm);
+
+  //Same ids as the partition store, records stay sorted by kmer
+  for(auto &r : records)
+    r.second = hashPartitionId((PidType)r.second);
+
+  //Local blocks, fence offsets relative to the first byte of this rank
+  std::vector<char> blocks;
+  std::vector<classifierFence_t> fences;
+  for(std::size_t first = 0; first < records.size(); first += CLASSIFIER_INDEX_BLOCK_RECORDS)
+  {
+    std::size_t last = std::min(first + CLASSIFIER_INDEX_BLOCK_RECORDS, records.size());
+    fences.emplace_back(records[first].first, blocks.size());
+
+    appendVarint(blocks, last - first);
+    uint64_t previousKmer = records[first].first;
+    for(std::size_t i = first; i < last; i++)
+    {
+      appendVarint(blocks, records[i].first - previousKmer);
+      appendVarint(blocks, records[i].second);
+      previousKmer = records[i].first;
+    }
+  }
+  uint64_t localKmers = records.size();
+  std::vector<kmerIndexRecord_t>().swap(records);
+
+  uint64_t localBytes = blocks.size(), localBlocks = fences.size();
+  uint64_t firstByte = 0, firstBlock = 0;
+  MPI_Exscan(&localBytes, &firstByte, 1, MPI_UINT64_T, MPI_SUM, comm);
+  MPI_Exscan(&localBlocks, &firstBlock, 1, MPI_UINT64_T, MPI_SUM, comm);
+  if(!rank) firstByte = firstBlock = 0;
+
+  uint64_t totalBytes = mxx::allreduce(localBytes, comm);
+  uint64_t totalBlocks = mxx::allreduce(localBlocks, comm);
+  uint64_t totalKmers = mxx::allreduce(localKmers, comm);
+
+  std::vector<char> fenceBuffer(fences.size() * 2 * sizeof(uint64_t));
+  uint64_t* field = reinterpret_cast<uint64_t*>(fenceBuffer.data());
+  for(auto it = fences.begin(); it != fences.end(); it++)
+  {
+    *field++ = it->first;
+    *field++ = sizeof(ClassifierIndexHeader) + firstByte + it->second;
+  }
+
+  ClassifierIndexHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, CLASSIFIER_INDEX_MAGIC, sizeof(header.magic));
+  header.version = CLASSIFIER_INDEX_VERSION;
+  header.kmerLength = KMER_LEN;
+  header.kmerCount = totalKmers;
+  header.blockCount = totalBlocks;
+  header.fenceOffset = sizeof(ClassifierIndexHeader) + totalBytes;
+  header.endianCheck = PARTITION_STORE_ENDIAN_CHECK;
+
+  MPI_File fh;
+  MPI_File_open(comm, filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+  MPI_File_set_size(fh, header.fenceOffset + totalBlocks * 2 * sizeof(uint64_t));
+
+  if(!rank)
+    MPI_File_write_at(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+
+  writeAtAllInRounds(fh, sizeof(ClassifierIndexHeader) + firstByte, blocks, comm);
+  writeAtAllInRounds(fh, header.fenceOffset + firstBlock * 2 * sizeof(uint64_t), fenceBuffer, comm);
+  MPI_File_close(&fh);
+
+  if(!rank)
+    std::cout << "Classifier index written to " << filename << ", " << totalKmers << " kmers in "
+      << header.fenceOffset + totalBlocks * 2 * sizeof(uint64_t) << " bytes\n";
+}
+
+/*
+ * @brief     Read only access to a classifier index through mmap, safe to share among threads
+ * @details   The fence table is copied to memory at open(). A lookup searches the fences and decodes
+ *            a single block, so only the pages of the blocks searched are loaded
+ */
+class ClassifierIndexReader
+{
+  private:
+
+    ClassifierIndexHeader header;
+    const char* data;
+    std::size_t bytes;
+    std::vector<classifierFence_t> fences;
+
+  public:
+
+    ClassifierIndexReader() : data(nullptr), bytes(0) {}
+
+    ~ClassifierIndexReader()
+    {
+      close();
+    }
+
+    /*
+     * @brief     Maps the index and loads the fence table, returns false with a message in error if it can not be used
+     */
+    bool open(const std::string& filename, std::string& error)
+    {
+      int fd = ::open(filename.c_str(), O_RDONLY);
+      struct stat st;
+      if(fd != -1 && fstat(fd, &st) == 0 && (std::size_t)st.st_size >= sizeof(ClassifierIndexHeader))
+      {
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(addr != MAP_FAILED)
+        {
+          data = static_cast<const char*>(addr);
+          bytes = st.st_size;
+        }
+      }
+      if(fd != -1)
+        ::close(fd);
+
+      if(data == nullptr)
+      {
+        error = "Can not open " + filename;
+        return false;
+      }
+
+      std::memcpy(&header, data, sizeof(header));
+      if(std::memcmp(header.magic, CLASSIFIER_INDEX_MAGIC, sizeof(header.magic)) != 0 || header.version != CLASSIFIER_INDEX_VERSION)
+        error = "Not a classifier index";
+      else if(header.endianCheck != PARTITION_STORE_ENDIAN_CHECK)
+        error = "Classifier index was written with a different byte order";
+      else if(header.kmerLength != KMER_LEN)
+        error = "Classifier index was written with kmer length " + std::to_string(header.kmerLength) + ", this build uses " + std::to_string(KMER_LEN);
+      else if(bytes < header.fenceOffset + header.blockCount * 2 * sizeof(uint64_t))
+        error = filename + " is truncated";
+      else
+      {
+        const uint64_t* field = reinterpret_cast<const uint64_t*>(data + header.fenceOffset);
+        fences.resize(header.blockCount);
+        for(auto& fence : fences)
+        {
+          fence.first = field[0];
+          fence.second = field[1];
+          field += 2;
+        }
+        return true;
+      }
+
+      return false;
+    }
+
+    //Unmaps the index
+    void close()
+    {
+      if(data != nullptr)
+        munmap(const_cast<char*>(data), bytes);
+      data = nullptr;
+      fences.clear();
+    }
+
+    uint64_t kmerCount() const
+    {
+      return header.kmerCount;
+    }
+
+    //Finds the partition of the canonical kmer, returns false if the kmer is not indexed
+    bool lookup(uint64_t kmer, uint64_t& pid) const
+    {
+      //Last block starting at or before the kmer
+      auto it = std::upper_bound(fences.begin(), fences.end(), classifierFence_t(kmer, std::numeric_limits<uint64_t>::max()));
+      if(it == fences.begin())
+        return false;
+      it--;
+
+      const unsigned char* p = reinterpret_cast<const unsigned char*>(data + it->second);
+      uint64_t count = readVarint(p);
+      uint64_t current = it->first;
+      for(uint64_t i = 0; i < count; i++)
+      {
+        current += readVarint(p);
+        uint64_t recordPid = readVarint(p);
+
+        if(current == kmer)
+        {
+          pid = recordPid;
+          return true;
+        }
+        if(current > kmer)
+          return false;
+      }
+
+      return false;
+    }
+};
+
+#endif
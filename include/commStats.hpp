@@ -0,0 +1,235 @@
+#ifndef COMM_STATS_HPP
+#define COMM_STATS_HPP
+
+//Includes
+#include <mpi.h>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+ * COMMUNICATION ACCOUNTING, built with cmake -DMETAG_COMM_STATS=ON
+ *
+ * src/commStats.cpp wraps the MPI calls used by this project and by mxx through the MPI profiling interface
+ * (PMPI), so the mxx sorts, all2all exchanges, block decompositions, gathers and reductions are counted
+ * without changing their code. For every call the rank adds the call and the payload it sends to other ranks :
+ *   all2all     Send counts to the other ranks
+ *   allgather   Own block once per other rank. Gathers and scatters count the blocks that leave the rank
+ *   reduce      Own vector once, for reductions and scans
+ *   bcast       Vector once per other rank on root
+ *   p2p         Sends and synchronous sends, including the send half of sendrecv
+ *   rma         One-sided gets and fetch-and-ops, counted on the rank that fetches the data
+ * Barriers count as calls only. The counts are split by the timed sections (MP_TIMER_END_SECTION) and by the
+ * iterations of the partitioning loop (MP_TRACE_ITERATION), and MP_COMM_REPORT() prints them at the end
+ */
+
+//Kinds of communication counted
+enum CommKind { COMM_ALL2ALL, COMM_ALLGATHER, COMM_REDUCE, COMM_BCAST, COMM_P2P, COMM_RMA, COMM_BARRIER, COMM_KINDS };
+
+const char* const COMM_KIND_NAMES[COMM_KINDS] = {"all2all", "allgather", "reduce", "bcast", "p2p", "rma", "barrier"};
+
+struct CommCounters
+{
+  uint64_t bytes[COMM_KINDS];
+  uint64_t calls[COMM_KINDS];
+
+  CommCounters()
+  {
+    for(int k = 0; k < COMM_KINDS; k++)
+      bytes[k] = calls[k] = 0;
+  }
+
+  uint64_t totalBytes() const
+  {
+    uint64_t sum = 0;
+    for(int k = 0; k < COMM_KINDS; k++)
+      sum += bytes[k];
+    return sum;
+  }
+
+  uint64_t totalCalls() const
+  {
+    uint64_t sum = 0;
+    for(int k = 0; k < COMM_KINDS; k++)
+      sum += calls[k];
+    return sum;
+  }
+
+  CommCounters& operator+=(const CommCounters& other)
+  {
+    for(int k = 0; k < COMM_KINDS; k++)
+    {
+      bytes[k] += other.bytes[k];
+      calls[k] += other.calls[k];
+    }
+    return *this;
+  }
+
+  CommCounters operator-(const CommCounters& other) const
+  {
+    CommCounters diff;
+    for(int k = 0; k < COMM_KINDS; k++)
+    {
+      diff.bytes[k] = bytes[k] - other.bytes[k];
+      diff.calls[k] = calls[k] - other.calls[k];
+    }
+    return diff;
+  }
+};
+
+#ifdef METAG_COMM_STATS
+
+//Running counts of this rank since the start, defined in commStats.cpp
+CommCounters& commCounters();
+
+//While true the wrappers don't count, so that the reports leave the counts unchanged
+bool& commCountingPaused();
+
+/*
+ * @brief     Splits the running counts of this rank by sections and iterations, and reports them
+ */
+class CommStats
+{
+  private:
+
+    //Pairs of <section name, counts during the section>, in order
+    std::vector<std::pair<std::string, CommCounters>> sections;
+    CommCounters sectionStart;
+
+    //Counts of every iteration of the partitioning loops, a loop run again adds to the same iterations
+    std::vector<CommCounters> iterations;
+    CommCounters iterationStart;
+    int currentIteration;
+
+    CommStats() : currentIteration(-1) {}
+
+    static double toMB(uint64_t bytes)
+    {
+      return bytes / double(1 << 20);
+    }
+
+    //Prints min/max/sum across the ranks of the counts on root, collective
+    static void reduceAndPrint(const std::string& label, const CommCounters& local, int rank, MPI_Comm comm)
+    {
+      uint64_t values[2] = {local.totalBytes(), local.totalCalls()};
+      uint64_t minimum[2], maximum[2], sum[2];
+      MPI_Reduce(values, minimum, 2, MPI_UINT64_T, MPI_MIN, 0, comm);
+      MPI_Reduce(values, maximum, 2, MPI_UINT64_T, MPI_MAX, 0, comm);
+      MPI_Reduce(values, sum, 2, MPI_UINT64_T, MPI_SUM, 0, comm);
+
+      CommCounters total;
+      MPI_Reduce(local.bytes, total.bytes, COMM_KINDS, MPI_UINT64_T, MPI_SUM, 0, comm);
+
+      if(!rank)
+      {
+        std::printf("[COMM] %s : %.2f/%.2f/%.2f MB, %llu/%llu/%llu calls (min/max/sum)", label.c_str(),
+            toMB(minimum[0]), toMB(maximum[0]), toMB(sum[0]), (unsigned long long)minimum[1],
+            (unsigned long long)maximum[1], (unsigned long long)sum[1]);
+        for(int k = 0; k < COMM_KINDS; k++)
+          if(total.bytes[k] > 0)
+            std::printf(", %s %.2f MB", COMM_KIND_NAMES[k], toMB(total.bytes[k]));
+        std::printf("\n");
+      }
+    }
+
+  public:
+
+    static CommStats& get()
+    {
+      static CommStats stats;
+      return stats;
+    }
+
+    //Counts since the last section end belong to this section
+    void endSection(const std::string& name)
+    {
+      CommCounters now = commCounters();
+      sections.emplace_back(name, now - sectionStart);
+      sectionStart = now;
+    }
+
+    //Counts from now on belong to this iteration, -1 outside the loop
+    void setIteration(int iteration)
+    {
+      CommCounters now = commCounters();
+      if(currentIteration >= 0)
+      {
+        if(iterations.size() <= (std::size_t)currentIteration)
+          iterations.resize(currentIteration + 1);
+        iterations[currentIteration] += now - iterationStart;
+      }
+      iterationStart = now;
+      currentIteration = iteration;
+    }
+
+    /*
+     * @brief     Prints the counts of every section and iteration, and of the whole run, as min/max/sum
+     *            across the ranks. If filename is not empty, root writes the counts of every rank to it. Collective
+     */
+    void report(const std::string& filename = "", MPI_Comm comm = MPI_COMM_WORLD)
+    {
+      commCountingPaused() = true;
+
+      int rank, p;
+      MPI_Comm_rank(comm, &rank);
+      MPI_Comm_size(comm, &p);
+
+      //Every rank ends the same sections, iterations may differ only if a rank has no tuples left
+      uint64_t localIterations = iterations.size(), maxIterations = 0;
+      MPI_Allreduce(&localIterations, &maxIterations, 1, MPI_UINT64_T, MPI_MAX, comm);
+      iterations.resize(maxIterations);
+
+      for(auto it = sections.begin(); it != sections.end(); it++)
+        reduceAndPrint(it->first, it->second, rank, comm);
+      for(std::size_t i = 0; i < iterations.size(); i++)
+        reduceAndPrint("Partitioning iteration " + std::to_string(i + 1), iterations[i], rank, comm);
+      reduceAndPrint("Total", commCounters(), rank, comm);
+
+      if(!filename.empty())
+      {
+        //Row of <bytes of every kind, calls of every kind> for every section, rows of all the ranks on root
+        std::vector<uint64_t> rows;
+        for(auto it = sections.begin(); it != sections.end(); it++)
+        {
+          rows.insert(rows.end(), it->second.bytes, it->second.bytes + COMM_KINDS);
+          rows.insert(rows.end(), it->second.calls, it->second.calls + COMM_KINDS);
+        }
+
+        std::vector<uint64_t> allRows(rank ? 0 : rows.size() * p);
+        MPI_Gather(rows.data(), (int)rows.size(), MPI_UINT64_T, allRows.data(), (int)rows.size(), MPI_UINT64_T, 0, comm);
+
+        if(!rank)
+        {
+          std::ofstream ofs(filename, std::ios_base::out);
+          ofs << "#section rank";
+          for(int k = 0; k < COMM_KINDS; k++)
+            ofs << " " << COMM_KIND_NAMES[k] << "_bytes";
+          for(int k = 0; k < COMM_KINDS; k++)
+            ofs << " " << COMM_KIND_NAMES[k] << "_calls";
+          ofs << "\n";
+
+          for(std::size_t s = 0; s < sections.size(); s++)
+            for(int r = 0; r < p; r++)
+            {
+              ofs << "\"" << sections[s].first << "\" " << r;
+              const uint64_t* row = allRows.data() + (r * sections.size() + s) * 2 * COMM_KINDS;
+              for(int k = 0; k < 2 * COMM_KINDS; k++)
+                ofs << " " << row[k];
+              ofs << "\n";
+            }
+        }
+      }
+
+      commCountingPaused() = false;
+    }
+};
+
+#define MP_COMM_ITERATION(i) CommStats::get().setIteration(i);
+#define MP_COMM_REPORT(file) CommStats::get().report(file);
+#else
+#define MP_COMM_ITERATION(i)
+#define MP_COMM_REPORT(file)
+#endif
+
+#endif
@@ -31,6 +31,68 @@ constexpr int MIN_READ_COUNT_FOR_ASSEMBLY = 5;
 //Can be modified
 const unsigned int MAX_READ_SIZE=128;
 
+//Assembler jobs with estimated fasta input up to these many bytes run in memFS (see configPath.hpp),
+//larger ones on localFS. Velvet output takes a few times the input size
+//Can be modified
+constexpr uint64_t MEMFS_INPUT_BYTES_THRESHOLD = 64 << 20;
+
+//memFS is memory of the node, shared by all its ranks and not seen by the memory report.
+//Jobs of a rank running in memFS take at most these many bytes together, each is charged
+//MEMFS_BYTES_PER_INPUT_BYTE times its input. Jobs which don't fit run on localFS
+//Can be modified
+constexpr uint64_t MEMFS_BYTES_PER_RANK = 256 << 20;
+constexpr uint64_t MEMFS_BYTES_PER_INPUT_BYTE = 4;
+
+//Partitions with fewer reads are assembled in-process by MiniAssembler instead of velvet
+//Set to 0 to use velvet for all partitions
+//Can be modified
+constexpr int MINI_ASSEMBLY_READ_THRESHOLD = 200;
+
+//Partitions with fewer reads are packed together into a single assembler input,
+//until the pack holds these many reads. Used only if velvet kmer size >= KMER_LEN
+//Can be modified
+constexpr int ASSEMBLY_BATCH_READ_BUDGET = 20000;
+
+//Partitions estimated to cost more than 1/(SCHEDULE_GRANULARITY * p) of the total
+//assembly work are placed on ranks greedily by cost, smaller ones by hashing their id
+//Can be modified
+constexpr int SCHEDULE_GRANULARITY = 16;
+
+//In the pipelined mode, reads of finished partitions are handed over to assembly
+//once they are at least this fraction of all the reads. The fraction doubles after every hand-off,
+//so there are at most log2(1/fraction + 1) hand-offs before the last batch, 2 for 0.2.
+//Every hand-off parses the whole input file once more to get the read sequences
+//Can be modified
+constexpr double PIPELINE_HANDOFF_READ_FRACTION = 0.2;
+
+//With --splitGiant, the largest partition is split by removing its high degree kmers
+//if it holds at least this fraction of all the reads
+//Can be modified
+constexpr double GIANT_COMPONENT_READ_FRACTION = 0.1;
+
+//Splitting of the largest partition stops once its largest piece holds at most this fraction of all the reads
+//Can be modified
+constexpr double GIANT_SPLIT_TARGET_FRACTION = 0.05;
+
+//Kmers of the largest partition occurring in fewer reads are never removed while splitting it,
+//and at most these many rounds of removal are done. Every round runs the partitioning iterations once
+//Can be modified
+constexpr int GIANT_KMER_MIN_DEGREE = 20;
+constexpr int GIANT_SPLIT_MAX_ROUNDS = 4;
+
+//Ranks writing to the same reads file of the partition store (--partitionStore)
+//Can be modified
+constexpr int PARTITION_STORE_RANKS_PER_FILE = 16;
+
+//Count of the largest partitions listed in the partition summaries
+//Can be modified
+constexpr int PARTITION_SUMMARY_TOP_COUNT = 20;
+
+//Records per compressed block of the classifier index (--classifierIndex). A lookup decodes one block,
+//the fence table kept in memory by the classifier takes 16 bytes per block
+//Can be modified
+constexpr std::size_t CLASSIFIER_INDEX_BLOCK_RECORDS = 64;
+
 //Print some more log output
 #define DEBUGLOG 0
 
@@ -41,13 +103,23 @@ const unsigned int MAX_READ_SIZE=128;
 //Assuming kmer-length is less than 32
 typedef uint64_t KmerIdType;
 
-//Assuming read count is less than 4 Billion
-//NOTE: Not sure about the correctness at the moment if following type is changed
+//Read ids are 32 bit unless the build sets METAG_64BIT_IDS (cmake -DMETAG_64BIT_IDS=ON),
+//which is needed for 4 billion reads or more. Read tags keep the read id below READ_TAG
+#ifdef METAG_64BIT_IDS
+typedef uint64_t ReadIdType;
+#else
 typedef uint32_t ReadIdType;
+#endif
 
 //Type definition for partition id
 typedef ReadIdType PidType;
 
+//Kmer layer of a read tag tuple during partitioning (see includeAllKmersAndReadTagsinFilteredReads)
+//Kmer ids use 2*KMER_LEN bits, so the highest bit is free to mark a tuple as read tag
+//Lower bits of the tagged kmer layer keep the read id
+const KmerIdType READ_TAG = KmerIdType(1) << (8 * sizeof(KmerIdType) - 1);
+static_assert(2 * KMER_LEN < 8 * sizeof(KmerIdType), "Kmer ids should leave the highest bit for read tags");
+
 //Type for defining read length
 typedef uint16_t ReadLenType;
 
@@ -55,7 +127,7 @@ typedef uint16_t ReadLenType;
 typedef uint16_t KmerFreqType;
 typedef uint16_t KmerSNoType;
 
-const unsigned int MAX = std::numeric_limits<ReadIdType>::max();
+const ReadIdType MAX = std::numeric_limits<ReadIdType>::max();
 const unsigned int MAX_INT = std::numeric_limits<int>::max();
 const uint16_t MAX_FREQ = std::numeric_limits<KmerFreqType>::max();
 
@@ -77,6 +149,18 @@ class readTuple {
     static const uint8_t seq = 0, rid = 1, pid = 2, cnt = 3;
 };
 
+//Order of layers in read to partition tuples (readid, partitionid)
+class readPidTuple {
+  public:
+    static const uint8_t rid = 0, pid = 1;
+};
+
+//Order of layers in partition statistics tuples (partitionid, count of reads, count of kmers)
+class partitionStatTuple {
+  public:
+    static const uint8_t pid = 0, reads = 1, kmers = 2;
+};
+
 //Struct to save command line options
 struct cmdLineParams {
   //Fastq file containing the reads
@@ -90,6 +174,42 @@ struct cmdLineParams {
 
   //Switch for running assembly method or not
   bool runAssembler;
+
+  //Placement of partitions on ranks for assembly ("lpt", "dynamic" or "contiguous")
+  std::string assemblySchedule;
+
+  //Count of assembler jobs each rank runs concurrently
+  int assemblerConcurrency;
+
+  //Switch for assembling partitions finished early while partitioning continues
+  bool pipelineAssembly;
+
+  //Switch for splitting the largest partition before assembly
+  bool splitGiant;
+
+  //Partitioned reads are saved in a partition store with this prefix, empty if not required
+  std::string partitionStorePrefix;
+
+  //Finished partitions are recorded in this directory, empty if not required
+  std::string ledgerDir;
+
+  //Switch for assembling only the partitions of the partition store which the ledger doesn't list
+  bool resumeAssembly;
+
+  //Kmer to partition mapping is saved in a kmer index with this prefix, empty if not required
+  std::string kmerIndexPrefix;
+
+  //Switch for partitioning the reads against the kmer index and adding them to it
+  bool incrementalPartitioning;
+
+  //Kmer to partition mapping is saved in a classifier index with this name, empty if not required
+  std::string classifierIndexFile;
+
+  //Timeline of the timed sections is written to this file in Chrome trace format, empty if not required
+  std::string traceFile;
+
+  //Memory allowed per rank in bytes, the run aborts once a phase goes or is expected to go past it. 0 if not set
+  uint64_t memoryBudget;
 };
 
 
@@ -112,14 +232,37 @@ struct cmdLineParamsGraph500 {
 
 /*
  * MXX TIMER
+ * Sections are also recorded for the trace file (--trace), along with the scopes marked by
+ * MP_TRACE_SCOPE and the collectives marked by MP_TRACE_COLLECTIVE, see sectionTrace.hpp.
+ * With the memory report (--memoryReport or --memoryBudget) every section reports its memory usage,
+ * including the vectors marked by MP_MEMORY_TRACK, see memoryUsage.hpp
  */
 #define MP_ENABLE_TIMER 1
 #if MP_ENABLE_TIMER
-#define MP_TIMER_START() mxx::section_timer timer;
+#include "sectionTrace.hpp"
+#define MP_TRACE_CONCAT_(a, b) a##b
+#define MP_TRACE_CONCAT(a, b) MP_TRACE_CONCAT_(a, b)
+#define MP_TIMER_START() tracedSectionTimer timer;
 #define MP_TIMER_END_SECTION(str) timer.end_section(str);
+#define MP_TRACE_SCOPE(str) traceScope MP_TRACE_CONCAT(traceScope_, __LINE__)(str);
+#define MP_TRACE_COLLECTIVE(str) traceScope MP_TRACE_CONCAT(traceScope_, __LINE__)(str, "collective");
+#define MP_TRACE_ITERATION(i) SectionTrace::get().setIteration(i); MP_COMM_ITERATION(i)
+#define MP_TRACE_ENABLE() SectionTrace::get().enable();
+#define MP_TRACE_WRITE(file) SectionTrace::get().write(file);
+#define MP_MEMORY_ENABLE(budget) MemoryUsage::get().enable(budget);
+#define MP_MEMORY_TRACK(str, vec) memoryTrackGuard MP_TRACE_CONCAT(memoryTrack_, __LINE__)(str, vec);
+#define MP_MEMORY_PROJECT(str, bytes) MemoryUsage::get().checkProjection(str, bytes);
 #else
 #define MP_TIMER_START()
 #define MP_TIMER_END_SECTION(str)
+#define MP_TRACE_SCOPE(str)
+#define MP_TRACE_COLLECTIVE(str)
+#define MP_TRACE_ITERATION(i)
+#define MP_TRACE_ENABLE()
+#define MP_TRACE_WRITE(file)
+#define MP_MEMORY_ENABLE(budget)
+#define MP_MEMORY_TRACK(str, vec)
+#define MP_MEMORY_PROJECT(str, bytes)
 #endif
 
 #endif
@@ -13,9 +13,9 @@
 //This path should be a valid directory on the execution node
 const std::string localFS = "/local/scratch/cjain7/";
 
-//Shared space for communicating reads across ranks (Used for only one time write and read)
-//This path should be a valid directory on the execution node
-const std::string sharedFS = "/lustre/alurugroup/Chirag/Metagenome_Data/tmpDirForCode"; 
+//Memory backed file system (tmpfs) for assembler input and output of small partitions
+//Local disk space is used instead if this path is not writable
+const std::string memFS = "/dev/shm/";
 
 //Absolute path to the project directory
 //We need to access source code folder during execution
@@ -0,0 +1,565 @@
+#ifndef KMER_INDEX_HPP
+#define KMER_INDEX_HPP
+
+//Includes
+#include <mpi.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//Includes from mxx library
+#include <mxx/collective.hpp>
+#include <mxx/reduction.hpp>
+#include <mxx/sort.hpp>
+
+//Own includes
+#include "sortTuples.hpp"
+#include "configParam.hpp"
+#include "partitionStore.hpp"
+
+/*
+ * KMER INDEX, the kmer to partition mapping of a partitioning result, for partitioning new reads incrementally
+ *
+ * Files with a common prefix :
+ *   <prefix>.kmers.<s>   Segment s, a header followed by (kmer, pid) records sorted by kmer. Segment 0 is written
+ *                        by a full run, every incremental run adds a segment with the kmers it didn't find.
+ *                        So a kmer is in a single segment
+ *   <prefix>.meta        A header followed by (pid, root pid) aliases sorted by pid, for the indexed partitions
+ *                        that incremental runs merged into others. Aliases point to the final roots directly
+ * All the fields are 64 bit integers in the byte order of the writer. Pids are read ids as assigned during
+ * partitioning, the reads of an incremental run get ids after all the reads indexed so far. The partition store
+ * lists the same partitions under hashPartitionId(pid)
+ */
+
+//Header at the beginning of every file of the index
+struct KmerIndexHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t kmerLength;
+
+  //Count of reads and segments indexed so far, kept in the meta file
+  uint64_t readCount;
+  uint64_t segmentCount;
+
+  //Count of records in a segment, count of aliases in the meta file
+  uint64_t count;
+  uint64_t endianCheck;
+  char padding[16];
+};
+static_assert(sizeof(KmerIndexHeader) == 64, "Kmer index header should take 64 bytes");
+
+const char KMER_INDEX_MAGIC[8] = {'M', 'E', 'T', 'A', 'G', 'K', 'I', '1'};
+const uint32_t KMER_INDEX_VERSION = 1;
+
+//Pair of <kmer, pid> in a segment, or <pid, root pid> in the meta file
+typedef std::pair<uint64_t, uint64_t> kmerIndexRecord_t;
+
+inline std::string kmerIndexSegmentFile(const std::string& prefix, uint64_t segment)
+{
+  return prefix + ".kmers." + std::to_string(segment);
+}
+
+inline std::string kmerIndexMetaFile(const std::string& prefix)
+{
+  return prefix + ".meta";
+}
+
+inline KmerIndexHeader makeKmerIndexHeader(uint64_t readCount, uint64_t segmentCount, uint64_t count)
+{
+  KmerIndexHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, KMER_INDEX_MAGIC, sizeof(header.magic));
+  header.version = KMER_INDEX_VERSION;
+  header.kmerLength = KMER_LEN;
+  header.readCount = readCount;
+  header.segmentCount = segmentCount;
+  header.count = count;
+  header.endianCheck = PARTITION_STORE_ENDIAN_CHECK;
+  return header;
+}
+
+/*
+ * @brief                 Distinct kmers of the kmer tuples along with their partitions, collective
+ * @param[in] localVector Kmer tuples (kmer, Pn, Pc) after partitioning, without read tags
+ * @return                Records sorted by kmer across the ranks, a kmer is listed once
+ */
+template <typename T>
+std::vector<kmerIndexRecord_t> collectKmerRecords(const std::vector<T>& localVector, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  static layer_comparator<0, kmerIndexRecord_t> kmerCmp;
+  auto sameKmer = [](const kmerIndexRecord_t& x, const kmerIndexRecord_t& y) { return x.first == y.first; };
+
+  //Every read with a kmer adds a tuple, so remove the local copies before the global sort
+  std::vector<kmerIndexRecord_t> records;
+  records.reserve(localVector.size());
+  for(auto it = localVector.begin(); it != localVector.end(); it++)
+    records.emplace_back(std::get<kmerTuple::kmer>(*it), std::get<kmerTuple::Pc>(*it));
+
+  std::sort(records.begin(), records.end(), kmerCmp);
+  records.erase(std::unique(records.begin(), records.end(), sameKmer), records.end());
+
+  mxx::sort(records.begin(), records.end(), kmerCmp, comm, false);
+  records.erase(std::unique(records.begin(), records.end(), sameKmer), records.end());
+
+  //Copies of a kmer on consecutive ranks, the lowest rank keeps it
+  std::vector<uint64_t> lastKmer(1, records.empty() ? 0 : records.back().first);
+  std::vector<uint64_t> isEmpty(1, records.empty());
+  auto allLastKmers = mxx::allgatherv(lastKmer, comm);
+  auto allEmpty = mxx::allgatherv(isEmpty, comm);
+
+  for(int r = rank - 1; r >= 0; r--)
+  {
+    if(allEmpty[r])
+      continue;
+
+    auto firstNew = records.begin();
+    while(firstNew != records.end() && firstNew->first == allLastKmers[r])
+      firstNew++;
+    records.erase(records.begin(), firstNew);
+    break;
+  }
+
+  return records;
+}
+
+/*
+ * @brief                 Writes the records of all the ranks as segment s, in rank order, collective
+ * @param[in] records     Sorted by kmer across the ranks, see collectKmerRecords()
+ */
+inline void writeKmerIndexSegment(const std::string& prefix, uint64_t segment, const std::vector<kmerIndexRecord_t>& records,
+                                  MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  std::vector<char> buffer(records.size() * 2 * sizeof(uint64_t));
+  uint64_t* field = reinterpret_cast<uint64_t*>(buffer.data());
+  for(auto it = records.begin(); it != records.end(); it++)
+  {
+    *field++ = it->first;
+    *field++ = it->second;
+  }
+
+  uint64_t localCount = records.size(), firstRecord = 0, totalCount = 0;
+  MPI_Exscan(&localCount, &firstRecord, 1, MPI_UINT64_T, MPI_SUM, comm);
+  if(!rank) firstRecord = 0;
+  MPI_Allreduce(&localCount, &totalCount, 1, MPI_UINT64_T, MPI_SUM, comm);
+
+  std::string filename = kmerIndexSegmentFile(prefix, segment);
+  MPI_File fh;
+  MPI_File_open(comm, filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+  MPI_File_set_size(fh, sizeof(KmerIndexHeader) + totalCount * 2 * sizeof(uint64_t));
+
+  KmerIndexHeader header = makeKmerIndexHeader(0, 0, totalCount);
+  if(!rank)
+    MPI_File_write_at(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+
+  writeAtAllInRounds(fh, sizeof(KmerIndexHeader) + firstRecord * 2 * sizeof(uint64_t), buffer, comm);
+  MPI_File_close(&fh);
+}
+
+/*
+ * @brief                 Writes the meta file, replacing the old one only once the new one is complete. Not collective
+ * @param[in] aliases     Sorted by pid
+ */
+inline bool writeKmerIndexMeta(const std::string& prefix, uint64_t readCount, uint64_t segmentCount,
+                               const std::vector<kmerIndexRecord_t>& aliases)
+{
+  std::string filename = kmerIndexMetaFile(prefix);
+  std::string tmpFilename = filename + ".tmp";
+
+  KmerIndexHeader header = makeKmerIndexHeader(readCount, segmentCount, aliases.size());
+
+  std::ofstream ofs(tmpFilename, std::ios_base::out | std::ios_base::binary);
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for(auto it = aliases.begin(); it != aliases.end(); it++)
+  {
+    uint64_t fields[2] = {it->first, it->second};
+    ofs.write(reinterpret_cast<const char*>(fields), sizeof(fields));
+  }
+  ofs.close();
+
+  return ofs.good() && std::rename(tmpFilename.c_str(), filename.c_str()) == 0;
+}
+
+/*
+ * @brief     Read only access to a kmer index, segments are searched through mmap
+ * @details   Only the pages holding the searched kmers are loaded, so a lookup costs a few page reads
+ *            per segment however large the index is. Aliases are loaded at open()
+ */
+class KmerIndexReader
+{
+  private:
+
+    struct Segment
+    {
+      const char* data;
+      std::size_t bytes;
+      uint64_t count;
+    };
+
+    KmerIndexHeader header;
+    std::vector<kmerIndexRecord_t> aliases;
+    std::vector<Segment> segments;
+
+    static bool validHeader(const KmerIndexHeader& h, std::string& error)
+    {
+      if(std::memcmp(h.magic, KMER_INDEX_MAGIC, sizeof(h.magic)) != 0 || h.version != KMER_INDEX_VERSION)
+        error = "Not a kmer index";
+      else if(h.endianCheck != PARTITION_STORE_ENDIAN_CHECK)
+        error = "Kmer index was written with a different byte order";
+      else if(h.kmerLength != KMER_LEN)
+        error = "Kmer index was written with kmer length " + std::to_string(h.kmerLength) + ", this build uses " + std::to_string(KMER_LEN);
+      else
+        return true;
+
+      return false;
+    }
+
+    const uint64_t* record(const Segment& s, uint64_t i) const
+    {
+      return reinterpret_cast<const uint64_t*>(s.data + sizeof(KmerIndexHeader)) + 2 * i;
+    }
+
+  public:
+
+    KmerIndexReader() {}
+
+    ~KmerIndexReader()
+    {
+      close();
+    }
+
+    /*
+     * @brief     Loads the meta file and maps the segments, returns false with a message in error if the index can not be used
+     */
+    bool open(const std::string& prefix, std::string& error)
+    {
+      std::ifstream ifs(kmerIndexMetaFile(prefix), std::ios_base::binary);
+      if(!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)))
+      {
+        error = "Can not open " + kmerIndexMetaFile(prefix);
+        return false;
+      }
+
+      if(!validHeader(header, error))
+        return false;
+
+      aliases.resize(header.count);
+      for(auto& alias : aliases)
+      {
+        uint64_t fields[2];
+        if(!ifs.read(reinterpret_cast<char*>(fields), sizeof(fields)))
+        {
+          error = "Kmer index meta file is truncated";
+          return false;
+        }
+        alias = kmerIndexRecord_t(fields[0], fields[1]);
+      }
+
+      for(uint64_t s = 0; s < header.segmentCount; s++)
+      {
+        std::string filename = kmerIndexSegmentFile(prefix, s);
+        Segment segment{nullptr, 0, 0};
+
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if(fd != -1 && fstat(fd, &st) == 0 && (std::size_t)st.st_size >= sizeof(KmerIndexHeader))
+        {
+          void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+          if(addr != MAP_FAILED)
+            segment = Segment{static_cast<const char*>(addr), (std::size_t)st.st_size, 0};
+        }
+        if(fd != -1)
+          ::close(fd);
+
+        if(segment.data == nullptr)
+        {
+          error = "Can not open " + filename;
+          return false;
+        }
+        segments.push_back(segment);
+
+        KmerIndexHeader segmentHeader;
+        std::memcpy(&segmentHeader, segment.data, sizeof(segmentHeader));
+        if(!validHeader(segmentHeader, error))
+          return false;
+
+        if(segment.bytes < sizeof(KmerIndexHeader) + segmentHeader.count * 2 * sizeof(uint64_t))
+        {
+          error = filename + " is truncated";
+          return false;
+        }
+        segments.back().count = segmentHeader.count;
+      }
+
+      return true;
+    }
+
+    //Unmaps the segments
+    void close()
+    {
+      for(auto& segment : segments)
+        munmap(const_cast<char*>(segment.data), segment.bytes);
+      segments.clear();
+    }
+
+    uint64_t readCount() const
+    {
+      return header.readCount;
+    }
+
+    uint64_t segmentCount() const
+    {
+      return header.segmentCount;
+    }
+
+    const std::vector<kmerIndexRecord_t>& aliasList() const
+    {
+      return aliases;
+    }
+
+    //Final partition of an indexed pid
+    uint64_t resolve(uint64_t pid) const
+    {
+      auto it = std::lower_bound(aliases.begin(), aliases.end(), kmerIndexRecord_t(pid, 0));
+      return (it != aliases.end() && it->first == pid) ? it->second : pid;
+    }
+
+    //Finds the partition of the kmer, returns false if the kmer is not indexed
+    bool lookup(uint64_t kmer, uint64_t& pid) const
+    {
+      for(auto& segment : segments)
+      {
+        uint64_t lo = 0, hi = segment.count;
+        while(lo < hi)
+        {
+          uint64_t mid = lo + (hi - lo) / 2;
+          if(record(segment, mid)[0] < kmer)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+
+        if(lo < segment.count && record(segment, lo)[0] == kmer)
+        {
+          pid = resolve(record(segment, lo)[1]);
+          return true;
+        }
+      }
+
+      return false;
+    }
+};
+
+/*
+ * @brief     Union find over the partition ids touched by an incremental run, the smallest id of a set is its root
+ * @details   Ids never united are not stored
+ */
+class PartitionUnionFind
+{
+  private:
+    std::unordered_map<uint64_t, uint64_t> parent;
+
+  public:
+    uint64_t find(uint64_t x)
+    {
+      auto it = parent.find(x);
+      if(it == parent.end())
+        return x;
+
+      //Path halving, every visited id is linked to its grandparent
+      while(it->second != x)
+      {
+        it->second = parent.find(it->second)->second;
+        x = it->second;
+        it = parent.find(x);
+      }
+      return x;
+    }
+
+    void unite(uint64_t x, uint64_t y)
+    {
+      parent.emplace(x, x);
+      parent.emplace(y, y);
+
+      x = find(x);
+      y = find(y);
+      if(x < y)
+        parent[y] = x;
+      else if(y < x)
+        parent[x] = y;
+    }
+
+    //Ids united with another, in any order
+    std::vector<uint64_t> members() const
+    {
+      std::vector<uint64_t> ids;
+      ids.reserve(parent.size());
+      for(auto it = parent.begin(); it != parent.end(); it++)
+        ids.push_back(it->first);
+      return ids;
+    }
+};
+
+/*
+ * @brief                 Writes the kmer index of a full run, collective
+ * @param[in] localVector Kmer tuples after partitioning, without read tags
+ * @param[in] localReadCount  Count of reads this rank parsed, pids of later runs start after all the reads
+ */
+template <typename T>
+void writeKmerIndex(const std::vector<T>& localVector, ReadIdType localReadCount, const std::string& prefix, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  uint64_t readCount = mxx::allreduce((uint64_t)localReadCount, comm);
+
+  std::vector<kmerIndexRecord_t> records = collectKmerRecords(localVector, comm);
+  uint64_t kmerCount = mxx::allreduce((uint64_t)records.size(), comm);
+
+  writeKmerIndexSegment(prefix, 0, records, comm);
+
+  if(!rank)
+  {
+    if(!writeKmerIndexMeta(prefix, readCount, 1, std::vector<kmerIndexRecord_t>()))
+      std::cerr << "Can not write " << kmerIndexMetaFile(prefix) << "\n";
+    else
+      std::cout << "Kmer index written with prefix " << prefix << ", " << kmerCount << " kmers of " << readCount << " reads\n";
+  }
+  MPI_Barrier(comm);
+}
+
+/*
+ * @brief                         Merges the partitions of new reads with the partitions of a kmer index, and adds
+ *                                the new reads to the index, collective
+ * @param[in/out] localVector     Kmer tuples of the new reads after partitioning, without read tags
+ * @param[in/out] readTagVector   Read tags of the new reads, Pc gives their final partition on return
+ * @param[in] localReadCount      Count of new reads this rank parsed
+ * @details
+ *            1.  Pids of the new partitions are shifted by the count of indexed reads, so they differ from the indexed ones
+ *            2.  Distinct kmers are sorted across the ranks and every rank looks up its own kmers in the index
+ *            3.  A kmer found in the index connects its new partition with an indexed partition. The distinct
+ *                connections are gathered on all the ranks and merged with union find. Smallest id is the root,
+ *                so a new partition joins an indexed one whenever it touches one
+ *            4.  Kmers and read tags are relabeled with the roots
+ *            5.  Kmers not found go to a new segment, indexed partitions merged into others to the aliases
+ *            Cost grows with the new reads and the partitions they touch, the indexed kmers are only searched
+ */
+template <typename T>
+void mergeWithKmerIndex(std::vector<T>& localVector, std::vector<T>& readTagVector, ReadIdType localReadCount,
+                        const std::string& prefix, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  MP_TIMER_START();
+
+  KmerIndexReader index;
+  std::string error;
+  if(!index.open(prefix, error))
+  {
+    std::cerr << "Rank " << rank << " : " << error << "\n";
+    MPI_Abort(comm, 1);
+  }
+
+  uint64_t indexedReads = index.readCount();
+  uint64_t newReads = mxx::allreduce((uint64_t)localReadCount, comm);
+  if(indexedReads + newReads > std::numeric_limits<PidType>::max())
+  {
+    if(!rank) std::cerr << "Partition ids of " << indexedReads + newReads << " reads need a build with METAG_64BIT_IDS\n";
+    MPI_Abort(comm, 1);
+  }
+
+  auto shift = [indexedReads](T& t) {
+    std::get<kmerTuple::Pc>(t) += indexedReads;
+    std::get<kmerTuple::Pn>(t) = std::get<kmerTuple::Pc>(t);};
+  std::for_each(localVector.begin(), localVector.end(), shift);
+  std::for_each(readTagVector.begin(), readTagVector.end(), shift);
+
+  std::vector<kmerIndexRecord_t> records = collectKmerRecords(localVector, comm);
+  MP_TIMER_END_SECTION("[INDEX TIMER] Distinct kmers of the new reads collected");
+
+  //Pairs of <new pid, indexed root> connected by a kmer, kmers not found stay in records
+  std::vector<kmerIndexRecord_t> connections;
+  auto newEnd = records.begin();
+  for(auto it = records.begin(); it != records.end(); it++)
+  {
+    uint64_t indexedPid;
+    if(index.lookup(it->first, indexedPid))
+      connections.emplace_back(it->second, indexedPid);
+    else
+      *newEnd++ = *it;
+  }
+  records.erase(newEnd, records.end());
+
+  std::sort(connections.begin(), connections.end());
+  connections.erase(std::unique(connections.begin(), connections.end()), connections.end());
+  auto allConnections = mxx::allgather_vectors(connections, comm);
+  std::vector<kmerIndexRecord_t>().swap(connections);
+  MP_TIMER_END_SECTION("[INDEX TIMER] Kmers looked up in the index");
+
+  PartitionUnionFind unionFind;
+  for(auto it = allConnections.begin(); it != allConnections.end(); it++)
+    unionFind.unite(it->first, it->second);
+
+  auto relabel = [&unionFind](T& t) {
+    std::get<kmerTuple::Pc>(t) = unionFind.find(std::get<kmerTuple::Pc>(t));
+    std::get<kmerTuple::Pn>(t) = std::get<kmerTuple::Pc>(t);};
+  std::for_each(localVector.begin(), localVector.end(), relabel);
+  std::for_each(readTagVector.begin(), readTagVector.end(), relabel);
+  for(auto it = records.begin(); it != records.end(); it++)
+    it->second = unionFind.find(it->second);
+
+  //Indexed roots merged into another root, and the old aliases pointing to them
+  std::vector<kmerIndexRecord_t> aliases = index.aliasList();
+  for(auto& alias : aliases)
+    alias.second = unionFind.find(alias.second);
+
+  std::size_t mergedPartitions = 0;
+  auto members = unionFind.members();
+  for(auto it = members.begin(); it != members.end(); it++)
+    if(*it < indexedReads && unionFind.find(*it) != *it)
+    {
+      aliases.emplace_back(*it, unionFind.find(*it));
+      mergedPartitions++;
+    }
+  std::sort(aliases.begin(), aliases.end());
+
+  uint64_t segment = index.segmentCount();
+
+  //Everyone is done with the old meta file before it is replaced
+  index.close();
+  MPI_Barrier(comm);
+
+  writeKmerIndexSegment(prefix, segment, records, comm);
+  uint64_t newKmers = mxx::allreduce((uint64_t)records.size(), comm);
+
+  if(!rank)
+  {
+    if(!writeKmerIndexMeta(prefix, indexedReads + newReads, segment + 1, aliases))
+    {
+      std::cerr << "Can not write " << kmerIndexMetaFile(prefix) << "\n";
+      MPI_Abort(comm, 1);
+    }
+
+    std::cout << "Kmer index updated with " << newReads << " reads and " << newKmers << " new kmers, "
+      << allConnections.size() << " connections to indexed partitions, " << mergedPartitions << " indexed partitions merged into others\n";
+  }
+  MPI_Barrier(comm);
+
+  MP_TIMER_END_SECTION("[INDEX TIMER] Kmer index updated");
+}
+
+#endif
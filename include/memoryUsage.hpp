@@ -0,0 +1,222 @@
+#ifndef MEMORY_USAGE_HPP
+#define MEMORY_USAGE_HPP
+
+//Includes
+#include <mpi.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * @brief           Resident set size of this process and its peak since the last reset, in bytes
+ * @details         Read from /proc/self/status, the peak falls back to getrusage() where it is not available
+ */
+inline void currentMemoryUsage(uint64_t& rss, uint64_t& peakRss)
+{
+  rss = peakRss = 0;
+
+  if(FILE* f = std::fopen("/proc/self/status", "r"))
+  {
+    char line[256];
+    unsigned long long kb;
+    while(std::fgets(line, sizeof(line), f))
+    {
+      if(std::sscanf(line, "VmRSS: %llu kB", &kb) == 1)
+        rss = kb << 10;
+      else if(std::sscanf(line, "VmHWM: %llu kB", &kb) == 1)
+        peakRss = kb << 10;
+    }
+    std::fclose(f);
+  }
+
+  if(peakRss == 0)
+  {
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+      peakRss = uint64_t(usage.ru_maxrss) << 10;
+  }
+
+  peakRss = std::max(peakRss, rss);
+}
+
+//Starts a new peak at the current resident set size, so that the next peak belongs to a single section.
+//Returns false if the kernel doesn't allow it, then peaks are since the start of the process
+inline bool resetPeakMemoryUsage()
+{
+  FILE* f = std::fopen("/proc/self/clear_refs", "w");
+  if(f == nullptr)
+    return false;
+
+  bool reset = std::fputs("5", f) >= 0;
+  return (std::fclose(f) == 0) && reset;
+}
+
+/*
+ * @brief     Memory high water marks of the timed sections, and an optional memory budget per rank
+ * @details   Once enabled, every MP_TIMER_END_SECTION reduces the resident set size, the peak resident
+ *            set size during the section and the capacity of the vectors tracked with MP_MEMORY_TRACK
+ *            to min/max/sum across the ranks, and root prints them. A rank whose peak goes past the budget
+ *            aborts the run at the end of the section, and MP_MEMORY_PROJECT aborts before a phase
+ *            expected to go past it. All of these are collective
+ */
+class MemoryUsage
+{
+  private:
+
+    bool enabled;
+    bool peakResets;
+    int rank;
+
+    //Bytes per rank, 0 if there is no budget
+    uint64_t budget;
+
+    //Pairs of <name, bytes held>, a removed entry keeps an empty name
+    std::vector<std::pair<std::string, std::function<uint64_t()>>> tracked;
+
+    MemoryUsage() : enabled(false), peakResets(false), rank(0), budget(0) {}
+
+    static double toMB(uint64_t bytes)
+    {
+      return bytes / double(1 << 20);
+    }
+
+  public:
+
+    static MemoryUsage& get()
+    {
+      static MemoryUsage usage;
+      return usage;
+    }
+
+    /*
+     * @brief     Starts reporting the memory usage at the end of every timed section, collective
+     * @param[in] budgetBytes   Memory allowed per rank, 0 for no budget
+     */
+    void enable(uint64_t budgetBytes, MPI_Comm comm = MPI_COMM_WORLD)
+    {
+      MPI_Comm_rank(comm, &rank);
+      budget = budgetBytes;
+      enabled = true;
+      peakResets = resetPeakMemoryUsage();
+
+      if(!rank && !peakResets)
+        std::cout << "[MEMORY] Peak resident set size can't be reset, peaks are since the start\n";
+    }
+
+    bool on() const
+    {
+      return enabled;
+    }
+
+    //Registers a source of bytes to report, returns the id for untrack()
+    std::size_t track(const std::string& name, std::function<uint64_t()> bytes)
+    {
+      tracked.emplace_back(name, bytes);
+      return tracked.size() - 1;
+    }
+
+    void untrack(std::size_t id)
+    {
+      tracked[id].first.clear();
+      while(!tracked.empty() && tracked.back().first.empty())
+        tracked.pop_back();
+    }
+
+    //Bytes held by the tracked vectors of this rank
+    uint64_t trackedBytes() const
+    {
+      uint64_t bytes = 0;
+      for(auto it = tracked.begin(); it != tracked.end(); it++)
+        if(!it->first.empty())
+          bytes += it->second();
+      return bytes;
+    }
+
+    /*
+     * @brief     Reports the memory usage of a finished section, collective
+     * @param[out] rssBytes, peakBytes    Resident set size and peak of this rank
+     */
+    void endSection(const std::string& name, uint64_t& rssBytes, uint64_t& peakBytes, MPI_Comm comm = MPI_COMM_WORLD)
+    {
+      currentMemoryUsage(rssBytes, peakBytes);
+
+      uint64_t local[3] = {rssBytes, peakBytes, trackedBytes()};
+      uint64_t minimum[3], maximum[3], sum[3];
+      MPI_Allreduce(local, minimum, 3, MPI_UINT64_T, MPI_MIN, comm);
+      MPI_Allreduce(local, maximum, 3, MPI_UINT64_T, MPI_MAX, comm);
+      MPI_Allreduce(local, sum, 3, MPI_UINT64_T, MPI_SUM, comm);
+
+      if(!rank)
+      {
+        std::printf("[MEMORY] %s : rss %.1f/%.1f/%.1f MB, peak %.1f/%.1f/%.1f MB, vectors %.1f/%.1f/%.1f MB (min/max/sum)\n",
+            name.c_str(), toMB(minimum[0]), toMB(maximum[0]), toMB(sum[0]), toMB(minimum[1]), toMB(maximum[1]), toMB(sum[1]),
+            toMB(minimum[2]), toMB(maximum[2]), toMB(sum[2]));
+        std::fflush(stdout);
+      }
+
+      if(budget > 0 && maximum[1] > budget)
+      {
+        if(peakBytes == maximum[1])
+          std::cerr << "Rank " << rank << " : peak memory " << toMB(peakBytes) << " MB during " << name
+            << " went past the budget of " << toMB(budget) << " MB per rank, run with more ranks or a larger budget\n";
+        MPI_Barrier(comm);
+        MPI_Abort(comm, 1);
+      }
+
+      if(peakResets)
+        resetPeakMemoryUsage();
+    }
+
+    /*
+     * @brief     Aborts the run if the phase is expected to go past the budget on any rank, collective
+     * @param[in] extraBytes    Memory the phase is expected to add to the current resident set size on this rank
+     */
+    void checkProjection(const std::string& phase, uint64_t extraBytes, MPI_Comm comm = MPI_COMM_WORLD)
+    {
+      if(budget == 0)
+        return;
+
+      uint64_t rss, peak;
+      currentMemoryUsage(rss, peak);
+
+      uint64_t projected = rss + extraBytes, maxProjected = 0;
+      MPI_Allreduce(&projected, &maxProjected, 1, MPI_UINT64_T, MPI_MAX, comm);
+
+      if(maxProjected > budget)
+      {
+        if(projected == maxProjected)
+          std::cerr << "Rank " << rank << " : " << phase << " is expected to take " << toMB(rss) << " + " << toMB(extraBytes)
+            << " MB, which is past the budget of " << toMB(budget) << " MB per rank. Run with more ranks or a larger budget\n";
+        MPI_Barrier(comm);
+        MPI_Abort(comm, 1);
+      }
+    }
+};
+
+/*
+ * @brief     Tracks the capacity of a vector in the memory report while the object lives
+ */
+class memoryTrackGuard
+{
+  private:
+    std::size_t id;
+
+  public:
+    template <typename T>
+    memoryTrackGuard(const std::string& name, const std::vector<T>& v)
+    {
+      id = MemoryUsage::get().track(name, [&v]() { return uint64_t(v.capacity()) * sizeof(T);});
+    }
+
+    ~memoryTrackGuard()
+    {
+      MemoryUsage::get().untrack(id);
+    }
+};
+
+#endif
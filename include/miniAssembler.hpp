@@ -0,0 +1,320 @@
+#ifndef MINI_ASSEMBLER_HPP
+#define MINI_ASSEMBLER_HPP
+
+//Includes
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//Own includes
+#include "configParam.hpp"
+#include "packedRead.hpp"
+#include "assemblyLedger.hpp"
+
+/*
+ * @brief     De Bruijn graph assembler for tiny partitions, runs in-process without files or processes
+ * @details
+ *            1.  Canonical kmers of the packed reads are counted in a sorted vector
+ *            2.  Unitigs are compacted by walking through nodes with single predecessor and successor
+ *            3.  Tips, i.e. dead end unitigs shorter than 2k bases, are removed and unitigs are compacted again
+ *            4.  Unitigs of at least 2k bases are reported as contigs, same as the velvet default
+ *            Contigs are buffered and appended to contigFile in bulk, headers look like
+ *            MINI_<n>_length_<kmers>_cov_<average kmer count> to follow velvet's naming.
+ *            With a ledger, the pids of the partitions are recorded whenever the buffer is flushed
+ * @NOTE      Only for DNA (A,C,G,T as 0,1,2,3 so that complement of x is 3-x) and k <= 32
+ */
+template <typename ReadInf>
+class MiniAssembler
+{
+  static_assert(ReadInf::bitsPerChar == 2, "Mini assembler supports 2 bit DNA alphabet only");
+
+  private:
+
+    int k;
+    uint64_t kmerMask;
+    std::size_t readThreshold;
+    std::string contigFile;
+    std::string outputBuffer;
+    uint64_t contigCount;
+
+    //Partitions with contigs in outputBuffer, only kept with a ledger
+    AssemblyLedger* ledger;
+    std::vector<PidType> bufferedPids;
+
+    //Canonical kmers and their counts, sorted by kmer. A zero count marks a removed kmer
+    std::vector<std::pair<uint64_t, uint32_t>> kmers;
+
+    //Reused buffers
+    std::vector<uint64_t> kmerBuffer;
+    std::vector<uint8_t> visited;
+
+    //Unitigs of the current partition, members are indices to kmers
+    struct Unitig
+    {
+      std::string seq;
+      uint64_t countSum;
+      std::size_t memberBegin, memberEnd;
+      bool deadStart, deadEnd;
+    };
+    std::vector<Unitig> unitigs;
+    std::vector<std::size_t> members;
+
+    //Flush buffered contigs once they take these many bytes
+    static constexpr std::size_t OUTPUT_BUFFER_BYTES = 1 << 20;
+
+    uint64_t reverseComplement(uint64_t x) const
+    {
+      uint64_t rc = 0;
+      for(int i = 0; i < k; i++)
+      {
+        rc = (rc << 2) | (3 - (x & 3));
+        x >>= 2;
+      }
+      return rc;
+    }
+
+    uint64_t canonical(uint64_t x) const
+    {
+      return std::min(x, reverseComplement(x));
+    }
+
+    //Index of the canonical kmer in kmers, or kmers.size() if absent
+    std::size_t find(uint64_t canonicalKmer) const
+    {
+      auto it = std::lower_bound(kmers.begin(), kmers.end(), std::make_pair(canonicalKmer, uint32_t(0)));
+
+      if(it != kmers.end() && it->first == canonicalKmer && it->second > 0)
+        return it - kmers.begin();
+      else
+        return kmers.size();
+    }
+
+    //Count of successors of the oriented kmer, next is set to the last one found
+    int successors(uint64_t x, uint64_t& next) const
+    {
+      int count = 0;
+      for(uint64_t c = 0; c < 4; c++)
+      {
+        uint64_t y = ((x << 2) | c) & kmerMask;
+        if(find(canonical(y)) != kmers.size())
+        {
+          next = y;
+          count++;
+        }
+      }
+      return count;
+    }
+
+    //Count of predecessors of the oriented kmer, prev is set to the last one found
+    int predecessors(uint64_t x, uint64_t& prev) const
+    {
+      uint64_t rcPrev = 0;
+      int count = successors(reverseComplement(x), rcPrev);
+      if(count > 0)
+        prev = reverseComplement(rcPrev);
+      return count;
+    }
+
+    //Builds unitigs from the kmers which are not removed
+    void compactUnitigs()
+    {
+      unitigs.clear();
+      members.clear();
+      visited.assign(kmers.size(), 0);
+
+      for(std::size_t i = 0; i < kmers.size(); i++)
+      {
+        if(kmers[i].second == 0 || visited[i])
+          continue;
+
+        visited[i] = 1;
+        Unitig u;
+        u.memberBegin = members.size();
+        members.push_back(i);
+
+        //Walk backwards first, prepending characters in reverse order
+        std::string prefix;
+        uint64_t first = kmers[i].first;
+        uint64_t cur = first, other = 0;
+        while(predecessors(cur, other) == 1)
+        {
+          uint64_t tmp;
+          std::size_t idx = find(canonical(other));
+          if(successors(other, tmp) != 1 || visited[idx])
+            break;
+
+          visited[idx] = 1;
+          members.push_back(idx);
+          prefix.push_back(ReadInf::ReadAlphabet::TO_ASCII[other >> (2 * (k - 1))]);
+          first = cur = other;
+        }
+
+        //Walk forwards
+        std::string suffix;
+        uint64_t last = kmers[i].first;
+        cur = last;
+        while(successors(cur, other) == 1)
+        {
+          uint64_t tmp;
+          std::size_t idx = find(canonical(other));
+          if(predecessors(other, tmp) != 1 || visited[idx])
+            break;
+
+          visited[idx] = 1;
+          members.push_back(idx);
+          suffix.push_back(ReadInf::ReadAlphabet::TO_ASCII[other & 3]);
+          last = cur = other;
+        }
+
+        u.memberEnd = members.size();
+
+        u.seq.assign(prefix.rbegin(), prefix.rend());
+        for(int j = k - 1; j >= 0; j--)
+          u.seq.push_back(ReadInf::ReadAlphabet::TO_ASCII[(kmers[i].first >> (2 * j)) & 3]);
+        u.seq += suffix;
+
+        u.countSum = 0;
+        for(std::size_t j = u.memberBegin; j < u.memberEnd; j++)
+          u.countSum += kmers[members[j]].second;
+
+        u.deadStart = (predecessors(first, other) == 0);
+        u.deadEnd = (successors(last, other) == 0);
+
+        unitigs.push_back(std::move(u));
+      }
+    }
+
+    //Removes short dead end unitigs attached to the rest of the graph, returns true if any was removed
+    bool clipTips()
+    {
+      bool removed = false;
+      for(auto& u : unitigs)
+      {
+        if(u.seq.size() < 2 * (std::size_t)k && (u.deadStart != u.deadEnd))
+        {
+          for(std::size_t j = u.memberBegin; j < u.memberEnd; j++)
+            kmers[members[j]].second = 0;
+          removed = true;
+        }
+      }
+      return removed;
+    }
+
+  public:
+
+    /*
+     * @param[in] k_                Kmer size, usually the velvet kmer size
+     * @param[in] readThreshold_    Partitions with fewer reads are accepted, zero disables the assembler
+     * @param[in] contigFile_       Contigs are appended to this file
+     * @param[in] ledger_           Records the assembled partitions if not null, its contig file should be contigFile_
+     */
+    MiniAssembler(int k_, std::size_t readThreshold_, const std::string& contigFile_, AssemblyLedger* ledger_ = nullptr)
+      : k(k_), readThreshold(readThreshold_), contigFile(contigFile_), contigCount(0), ledger(ledger_)
+    {
+      //Kmers should fit in a 64 bit word
+      if(k < 1 || k > 32)
+        readThreshold = 0;
+
+      kmerMask = (k >= 32) ? ~uint64_t(0) : ((uint64_t(1) << (2 * k)) - 1);
+    }
+
+    ~MiniAssembler()
+    {
+      flush();
+    }
+
+    //True if partition of this size should be assembled here
+    bool accepts(std::size_t readCount) const
+    {
+      return readCount < readThreshold;
+    }
+
+    //Assembles the reads in range [first, last) of read sequence tuples
+    template <typename Iter>
+    void assemble(Iter first, Iter last)
+    {
+      //Count canonical kmers
+      kmerBuffer.clear();
+      for(auto it = first; it != last; it++)
+      {
+        auto& readPacked = std::get<readTuple::seq>(*it);
+        int readLength = std::get<readTuple::cnt>(*it);
+        int bitPos = ReadInf::bitstream::nBits - ReadInf::bitsPerChar;
+
+        uint64_t fwd = 0, rev = 0;
+        for(int i = 0; i < readLength; i++, bitPos -= ReadInf::bitsPerChar)
+        {
+          typename ReadInf::ReadWordType c;
+          getBitsAtPos<ReadInf>(readPacked, c, bitPos, ReadInf::bitsPerChar);
+
+          fwd = ((fwd << 2) | c) & kmerMask;
+          rev = (rev >> 2) | (uint64_t(3 - c) << (2 * (k - 1)));
+
+          if(i >= k - 1)
+            kmerBuffer.push_back(std::min(fwd, rev));
+        }
+      }
+
+      std::sort(kmerBuffer.begin(), kmerBuffer.end());
+
+      kmers.clear();
+      for(auto it = kmerBuffer.begin(); it != kmerBuffer.end(); it++)
+      {
+        if(!kmers.empty() && kmers.back().first == *it)
+          kmers.back().second++;
+        else
+          kmers.emplace_back(*it, 1);
+      }
+
+      //Few rounds of tip removal are enough for tiny graphs
+      compactUnitigs();
+      for(int round = 0; round < 3 && clipTips(); round++)
+        compactUnitigs();
+
+      for(auto& u : unitigs)
+      {
+        if(u.seq.size() < 2 * (std::size_t)k)
+          continue;
+
+        std::size_t nodes = u.memberEnd - u.memberBegin;
+        contigCount++;
+        outputBuffer += ">MINI_" + std::to_string(contigCount) + "_length_" + std::to_string(nodes)
+          + "_cov_" + std::to_string((double)u.countSum / nodes) + "\n";
+        outputBuffer += u.seq;
+        outputBuffer += "\n";
+      }
+
+      if(ledger)
+        bufferedPids.push_back(std::get<readTuple::pid>(*first));
+
+      if(outputBuffer.size() >= OUTPUT_BUFFER_BYTES)
+        flush();
+    }
+
+    //Appends the buffered contigs to the contig file
+    void flush()
+    {
+      if(outputBuffer.empty() && bufferedPids.empty())
+        return;
+
+      uint64_t offset = ledger ? ledger->contigBytes() : 0;
+
+      std::ofstream ofs(contigFile, std::ios_base::app | std::ios_base::binary);
+      ofs.write(outputBuffer.data(), outputBuffer.size());
+      ofs.close();
+      outputBuffer.clear();
+
+      if(ledger)
+        ledger->record(bufferedPids, offset, ledger->contigBytes() - offset);
+      bufferedPids.clear();
+    }
+
+    //Count of contigs reported so far
+    uint64_t contigsReported() const
+    {
+      return contigCount;
+    }
+};
+
+#endif
@@ -1,6 +1,16 @@
 #ifndef PACKED_READ_H
 #define PACKED_READ_H
 
+//Includes
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+
+#if defined(__SSSE3__) || defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
 //Includes from BLISS
 #include <common/alphabets.hpp>
 #include <common/alphabet_traits.hpp>
@@ -98,7 +108,7 @@ inline void getBitsAtPos(std::array<T, N>& readPacked, WType &charVal, int bitPo
 
 
 /*
- * @brief     returns read characters packed as bits inside a vector
+ * @brief     returns read characters packed as bits inside a vector, one character at a time
  * @param[in] start             Beginning of the sequence iterator in a read
  * @param[in] end               Ending
  *
@@ -107,7 +117,7 @@ inline void getBitsAtPos(std::array<T, N>& readPacked, WType &charVal, int bitPo
  * @param[out] readPacked       Read content stored inside this vector
  */
 template <typename ReadInf, typename InputIterator, typename T, std::size_t N>
-void getPackedRead(std::array<T, N>& readPacked, InputIterator start, InputIterator end)
+void getPackedReadScalar(std::array<T, N>& readPacked, InputIterator start, InputIterator end)
 {
   int bitPos = ReadInf::bitstream::nBits - ReadInf::bitsPerChar;
 
@@ -119,12 +129,14 @@ void getPackedRead(std::array<T, N>& readPacked, InputIterator start, InputItera
   } 
 }
 
-
+/*
+ * @brief     Unpacks the read characters as ASCII, one character at a time
+ * @param[out] sequence         Should have space for readLength characters
+ */
 template <typename ReadInf, typename T, std::size_t N>
-void getUnPackedRead(std::array<T, N>& readPacked, ReadIdType readLength, std::string &sequence)
+void getUnPackedReadScalar(std::array<T, N>& readPacked, ReadIdType readLength, char* sequence)
 {
   int bitPos = ReadInf::bitstream::nBits - ReadInf::bitsPerChar;
-  sequence.resize(readLength);
 
   for (int i = 0; i < readLength; i++) 
   {
@@ -137,4 +149,175 @@ void getUnPackedRead(std::array<T, N>& readPacked, ReadIdType readLength, std::s
   }
 }
 
+/*
+ * WORD AT A TIME KERNELS
+ * With 2 bit characters and 64 bit words filling the bitstream exactly, character i of a read
+ * sits in word (nWords - 1 - i/32), with the first of the 32 characters in its most significant bits.
+ * Kernels below convert a whole word at a time, using SSSE3 shuffles or BMI2 PEXT when the compiler
+ * targets them (e.g. -march=native), and byte lookups otherwise
+ */
+
+//Characters in a 64 bit word
+const int CHARS_PER_PACKED_WORD = 32;
+
+//True if the word at a time kernels understand the layout of the packed read
+template <typename ReadInf>
+struct packedWordKernelsApply
+{
+  static constexpr bool value = ReadInf::bitsPerChar == 2 && ReadInf::bitstream::bitsPerWord == 64
+    && ReadInf::bitstream::nBits % 64 == 0;
+};
+
+//ASCII of the four characters packed in every byte value
+template <typename ReadInf>
+struct packedByteToAscii
+{
+  char ascii[256][4];
+
+  packedByteToAscii()
+  {
+    for(int b = 0; b < 256; b++)
+      for(int j = 0; j < 4; j++)
+        ascii[b][j] = ReadInf::ReadAlphabet::TO_ASCII[(b >> (6 - 2*j)) & 3];
+  }
+
+  static const packedByteToAscii& get()
+  {
+    static const packedByteToAscii table;
+    return table;
+  }
+};
+
+//Writes the 32 characters packed in word as ASCII
+template <typename ReadInf>
+inline void unpackWordToAscii(uint64_t word, char* out)
+{
+#if defined(__SSSE3__)
+  const char* toAscii = ReadInf::ReadAlphabet::TO_ASCII;
+  const __m128i lookup = _mm_setr_epi8(toAscii[0], toAscii[1], toAscii[2], toAscii[3], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i charMask = _mm_set1_epi32(0x030C30C0);
+  const __m128i w = _mm_cvtsi64_si128(word);
+
+  //Every byte holds 4 characters, replicate it to 4 lanes, most significant byte first
+  __m128i halves[2] = { _mm_shuffle_epi8(w, _mm_setr_epi8(7, 7, 7, 7, 6, 6, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4)),
+                        _mm_shuffle_epi8(w, _mm_setr_epi8(3, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0)) };
+
+  for(int h = 0; h < 2; h++)
+  {
+    //Keep a different character in each of the 4 lanes and move it to the low bits
+    //Shifts by 16 bit lanes only pull bits of the neighbouring byte above the low 2 bits
+    __m128i v = _mm_and_si128(halves[h], charMask);
+    v = _mm_or_si128(_mm_or_si128(v, _mm_srli_epi16(v, 2)), _mm_or_si128(_mm_srli_epi16(v, 4), _mm_srli_epi16(v, 6)));
+    v = _mm_and_si128(v, _mm_set1_epi8(3));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16*h), _mm_shuffle_epi8(lookup, v));
+  }
+#else
+  auto& table = packedByteToAscii<ReadInf>::get();
+  for(int j = 0; j < 8; j++)
+    std::memcpy(out + 4*j, table.ascii[(word >> (56 - 8*j)) & 0xFF], 4);
+#endif
+}
+
+//Packs the 32 characters in codes, each within 0..3, to a word
+inline uint64_t packWordFromCodes(const uint8_t* codes)
+{
+  uint64_t word = 0;
+
+#if defined(__BMI2__)
+  for(int q = 0; q < 4; q++)
+  {
+    uint64_t x;
+    std::memcpy(&x, codes + 8*q, 8);
+
+    //First character of the group goes to the most significant bits
+    word = (word << 16) | _pext_u64(__builtin_bswap64(x), 0x0303030303030303ULL);
+  }
+#elif defined(__SSSE3__)
+  for(int h = 0; h < 2; h++)
+  {
+    __m128i v = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(codes + 16*h)), _mm_set1_epi8(3));
+
+    //Merge pairs of characters into 4 bits and then pairs of those into bytes, first character on top
+    v = _mm_maddubs_epi16(v, _mm_set1_epi16(0x0104));
+    v = _mm_packus_epi16(v, v);
+    v = _mm_maddubs_epi16(v, _mm_set1_epi16(0x0110));
+    v = _mm_packus_epi16(v, v);
+
+    word = (word << 32) | __builtin_bswap32(static_cast<uint32_t>(_mm_cvtsi128_si32(v)));
+  }
+#else
+  for(int i = 0; i < CHARS_PER_PACKED_WORD; i++)
+    word = (word << 2) | (codes[i] & 3);
+#endif
+
+  return word;
+}
+
+/*
+ * @brief     returns read characters packed as bits inside a vector
+ * @param[in] start             Beginning of the sequence iterator in a read
+ * @param[in] end               Ending
+ *
+ * Note that InputIterator has value domain consistent with the valid values in the alphabet
+ *
+ * @param[out] readPacked       Read content stored inside this vector
+ */
+template <typename ReadInf, typename InputIterator, typename T, std::size_t N>
+void getPackedRead(std::array<T, N>& readPacked, InputIterator start, InputIterator end)
+{
+  if(!packedWordKernelsApply<ReadInf>::value)
+  {
+    getPackedReadScalar<ReadInf>(readPacked, start, end);
+    return;
+  }
+
+  uint8_t codes[CHARS_PER_PACKED_WORD];
+  auto iter = start;
+
+  for(int wordId = N - 1; wordId >= 0 && iter != end; wordId--)
+  {
+    int count = 0;
+    for(; count < CHARS_PER_PACKED_WORD && iter != end; ++iter)
+      codes[count++] = *iter;
+
+    std::fill(codes + count, codes + CHARS_PER_PACKED_WORD, 0);
+    readPacked[wordId] |= static_cast<T>(packWordFromCodes(codes));
+  }
+}
+
+/*
+ * @brief     Unpacks the read characters as ASCII
+ * @param[out] sequence         Should have space for readLength characters
+ */
+template <typename ReadInf, typename T, std::size_t N>
+void getUnPackedRead(std::array<T, N>& readPacked, ReadIdType readLength, char* sequence)
+{
+  if(!packedWordKernelsApply<ReadInf>::value)
+  {
+    getUnPackedReadScalar<ReadInf>(readPacked, readLength, sequence);
+    return;
+  }
+
+  int wordId = N - 1;
+  ReadIdType i = 0;
+  for(; i + CHARS_PER_PACKED_WORD <= readLength; i += CHARS_PER_PACKED_WORD, wordId--)
+    unpackWordToAscii<ReadInf>(readPacked[wordId], sequence + i);
+
+  //Last partial word goes through a buffer to keep the writes within sequence
+  if(i < readLength)
+  {
+    char buffer[CHARS_PER_PACKED_WORD];
+    unpackWordToAscii<ReadInf>(readPacked[wordId], buffer);
+    std::memcpy(sequence + i, buffer, readLength - i);
+  }
+}
+
+template <typename ReadInf, typename T, std::size_t N>
+void getUnPackedRead(std::array<T, N>& readPacked, ReadIdType readLength, std::string &sequence)
+{
+  sequence.resize(readLength);
+  getUnPackedRead<ReadInf>(readPacked, readLength, &sequence[0]);
+}
+
 #endif
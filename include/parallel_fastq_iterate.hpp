@@ -22,6 +22,9 @@
 //Includes from mxx library
 #include <mxx/datatypes.hpp>
 #include <mxx/shift.hpp>
+#include <mxx/collective.hpp>
+
+#include <numeric>
 
 
 /**
@@ -34,10 +37,11 @@
  * @tparam T                      Type of elements in a vector to populate which should be std::vector of tuples
  * @tparam typeOfReadingOperation Determines what information we need from FASTQ reads 
  * @param[out] localVector        Reference of vector to populate
+ * @return                        Count of reads parsed by this rank
  * @note                          This function should be called by all MPI ranks
  */
 template <typename KmerType, typename typeOfReadingOperation, typename T>
-void readFASTQFile(     cmdLineParams &cmdLineVals,
+ReadIdType readFASTQFile(     cmdLineParams &cmdLineVals,
                         std::vector<T>& localVector,
                         std::vector<bool>& readFilterFlags,
                         std::vector<ReadLenType>& readTrimLengths,
@@ -141,6 +145,24 @@ void readFASTQFile(     cmdLineParams &cmdLineVals,
 
   if(rank == 0)
     std::cout << "Total count of tuples: " << globalVecSize << " \n";
+
+  return readId;
+}
+
+/*
+ * @brief     Gathers the first global read id of every rank
+ * @details   Read ids are made unique by an exclusive scan over the local read counts in globalUniquenessOfIds(), 
+ *            therefore rank i parsed the reads [readIdOffsets[i], readIdOffsets[i+1])
+ * @param[in] localReadCount    Count of reads parsed by this rank, as returned by readFASTQFile()
+ */
+inline std::vector<ReadIdType> getReadIdOffsets(ReadIdType localReadCount, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  std::vector<ReadIdType> readCounts = mxx::allgather(localReadCount, comm);
+
+  std::vector<ReadIdType> readIdOffsets(readCounts.size() + 1, 0);
+  std::partial_sum(readCounts.begin(), readCounts.end(), readIdOffsets.begin() + 1);
+
+  return readIdOffsets;
 }
 
 /*
@@ -225,103 +247,6 @@ struct includeAllKmers
 
 };
 
-/*
- * Generate a vector of tuples(kmer, Pn, Pc) from FASTQ file for each MPI process
- * Ignore the reads which are discarded during preProcess stage
- * Each Pn and Pc should by initialized with readIds
- */
-template <typename KmerType>
-struct includeAllKmersinFilteredReads
-{
-  //Reserve space in the vector
-  template <typename T>
-  void reserveSpace(std::vector<T>& localVector, size_t num_kmers, size_t num_reads)
-  {
-    localVector.reserve(num_kmers * 1.1);
-  }
-
-  //Fill values in the localVector
-  template <typename T, typename BaseCharIterator>
-  void fillValuesfromReads(std::vector<T>& localVector, BaseCharIterator charStart, BaseCharIterator charEnd, 
-                          std::vector<bool>& readFilterFlags, std::vector<ReadLenType>& readTrimLengths, 
-                          ReadIdType readId)
-  {
-    /// kmer generation iterator
-    using KmerIterType = bliss::common::KmerGenerationIterator<BaseCharIterator, KmerType>;
-
-    //== set up the kmer generating iterators.
-    KmerIterType start(charStart, true);
-    KmerIterType end(charEnd, false);
-
-    //Count how many kmers are we allowed to parse from this read
-    int countKmersToRead = 0;
-    if(readFilterFlags[readId] == true)
-      countKmersToRead = MAX_INT;
-    else if(readFilterFlags[readId] == false)
-    {
-      if(readTrimLengths[readId] == 0)
-        countKmersToRead = 0;
-      else
-      {
-        countKmersToRead = std::max(0, readTrimLengths[readId] - KMER_LEN + 1); 
-      }
-    }
-
-    for (; start != end; ++start)
-    {
-      //Read filters affect here
-      if(countKmersToRead-- == 0)
-        break;
-
-      //New tuple that goes inside the vector
-      T tupleToInsert;
-
-      //Current kmer
-      auto originalKmer = *start;
-
-      //Get the reverse complement
-      auto reversedKmer = (*start).reverse_complement();
-
-      //Choose the minimum of two to insert in the vector
-      auto KmerToinsert = (originalKmer < reversedKmer) ? originalKmer : reversedKmer;
-
-      //getPrefix() on kmer gives a 64-bit prefix for hashing 
-      std::get<kmerTuple::kmer>(tupleToInsert) = (KmerToinsert).getPrefix();
-      std::get<kmerTuple::Pn>(tupleToInsert) = readId;
-      std::get<kmerTuple::Pc>(tupleToInsert) = readId;
-
-      //Insert tuple to vector
-      localVector.push_back(tupleToInsert);
-    }
-  }
-
-  //Maintain the global order of Ids across all MPI ranks
-  template <typename T>
-  void globalUniquenessOfIds(std::vector<T>& localVector, ReadIdType localReadCount, MPI_Comm comm)
-  {
-    int rank;
-    MPI_Comm_rank(comm, &rank);
-
-    ReadIdType previousReadIdSum;
-
-    //Get MPI Datatype using mxx library
-    mxx::datatype<ReadIdType> MPI_ReadIDType;
-    MPI_Exscan(&localReadCount, &previousReadIdSum, 1, MPI_ReadIDType.type(), MPI_SUM, comm);
-
-
-    //Update all elements
-    if(rank > 0)
-    {
-      for ( auto& eachTuple : localVector) 
-      {
-        //Update Pn and Pc
-        std::get<kmerTuple::Pn>(eachTuple) = std::get<kmerTuple::Pn>(eachTuple) + previousReadIdSum;
-        std::get<kmerTuple::Pc>(eachTuple) = std::get<kmerTuple::Pn>(eachTuple);
-      }
-    }
-  }
-};
-
 /*
  * Generate a vector of tuples(kmer, Pn, Pc) from FASTQ file for each MPI process
  * Each Pn and Pc should by initialized with readIds
@@ -406,15 +331,18 @@ struct includeAllKmersinAllReads
  * Generate a vector of tuples(kmer, Pn, Pc) from FASTQ file for each MPI process
  * Ignore the reads which are discarded during preProcess stage
  * Each Pn and Pc should by initialized with readIds
+ * Besides the kmers, one read tag tuple (READ_TAG | readId, readId, readId) is added for every read 
+ * which contributes kmers. Its kmer layer is unique, so it gets marked as internal kmer and carries 
+ * the final partition id of the read in its Pc layer after the partitioning iterations
  */
 template <typename KmerType>
-struct includeFirstKmersinFilteredReads
+struct includeAllKmersAndReadTagsinFilteredReads
 {
   //Reserve space in the vector
   template <typename T>
   void reserveSpace(std::vector<T>& localVector, size_t num_kmers, size_t num_reads)
   {
-    localVector.reserve(num_reads);
+    localVector.reserve(num_kmers * 1.1 + num_reads);
   }
 
   //Fill values in the localVector
@@ -444,9 +372,15 @@ struct includeFirstKmersinFilteredReads
       }
     }
 
-    //Either the filter switch is off or if its own, flag should be true
-    if(countKmersToRead > 0)
+    //Remember if this read contributed any kmer
+    bool kmersInserted = false;
+
+    for (; start != end; ++start)
     {
+      //Read filters affect here
+      if(countKmersToRead-- == 0)
+        break;
+
       //New tuple that goes inside the vector
       T tupleToInsert;
 
@@ -461,11 +395,23 @@ struct includeFirstKmersinFilteredReads
 
       //getPrefix() on kmer gives a 64-bit prefix for hashing 
       std::get<kmerTuple::kmer>(tupleToInsert) = (KmerToinsert).getPrefix();
-      std::get<kmerTuple::Pn>(tupleToInsert) = MAX;
+      std::get<kmerTuple::Pn>(tupleToInsert) = readId;
       std::get<kmerTuple::Pc>(tupleToInsert) = readId;
 
       //Insert tuple to vector
       localVector.push_back(tupleToInsert);
+      kmersInserted = true;
+    }
+
+    //Reads without kmers are not part of any partition
+    if(kmersInserted)
+    {
+      T tagToInsert;
+      std::get<kmerTuple::kmer>(tagToInsert) = READ_TAG | readId;
+      std::get<kmerTuple::Pn>(tagToInsert) = readId;
+      std::get<kmerTuple::Pc>(tagToInsert) = readId;
+
+      localVector.push_back(tagToInsert);
     }
   }
 
@@ -488,8 +434,13 @@ struct includeFirstKmersinFilteredReads
     {
       for ( auto& eachTuple : localVector) 
       {
-        //Update Pc only
-        std::get<kmerTuple::Pc>(eachTuple) = std::get<kmerTuple::Pc>(eachTuple) + previousReadIdSum;
+        //Update Pn and Pc
+        std::get<kmerTuple::Pn>(eachTuple) = std::get<kmerTuple::Pn>(eachTuple) + previousReadIdSum;
+        std::get<kmerTuple::Pc>(eachTuple) = std::get<kmerTuple::Pn>(eachTuple);
+
+        //Read tags keep the read id in their kmer layer as well
+        if(std::get<kmerTuple::kmer>(eachTuple) & READ_TAG)
+          std::get<kmerTuple::kmer>(eachTuple) = READ_TAG | std::get<kmerTuple::Pn>(eachTuple);
       }
     }
   }
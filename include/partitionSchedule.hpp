@@ -0,0 +1,269 @@
+#ifndef PARTITION_SCHEDULE_HPP
+#define PARTITION_SCHEDULE_HPP
+
+//Includes
+#include <mpi.h>
+#include <cmath>
+#include <queue>
+#include <unordered_map>
+
+//Includes from mxx library
+#include <mxx/collective.hpp>
+#include <mxx/reduction.hpp>
+
+//Own includes
+#include "sortTuples.hpp"
+#include "configParam.hpp"
+
+//tuple of type <PartitionId, Count of reads, Count of kmers>
+//This order is defined in configParam.hpp as <pid,reads,kmers>
+typedef std::tuple<PidType, uint64_t, uint64_t> partitionStat_t;
+
+/*
+ * @brief     Estimated work of assembling a partition with Velvet
+ * @details   Graph construction is linear in the reads, while the graph traversal and error
+ *            correction grow superlinearly with the kmers in the de Bruijn graph.
+ *            Partitions below MIN_READ_COUNT_FOR_ASSEMBLY are never assembled
+ */
+inline double estimateAssemblyCost(uint64_t readCount, uint64_t kmerCount)
+{
+  if(readCount < MIN_READ_COUNT_FOR_ASSEMBLY)
+    return 0.0;
+
+  return readCount + kmerCount * std::log2(2.0 + kmerCount);
+}
+
+/*
+ * @brief                       Sums up partial statistics of the partitions, collective
+ * @param[in] statsVector       Partial counts, a partition may be listed by many ranks and many times on a rank
+ * @return                      Statistics of the partitions with pid % p == rank, sorted by pid.
+ *                              Every partition is listed by exactly one rank
+ */
+inline std::vector<partitionStat_t> mergePartitionStats(std::vector<partitionStat_t>& statsVector, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int p;
+  MPI_Comm_size(comm, &p);
+
+  //Send partial counts to the rank owning statistics of the partition
+  std::sort(statsVector.begin(), statsVector.end(),
+      [p](const partitionStat_t& x, const partitionStat_t& y){
+      return std::make_pair(std::get<partitionStatTuple::pid>(x) % p, std::get<partitionStatTuple::pid>(x))
+           < std::make_pair(std::get<partitionStatTuple::pid>(y) % p, std::get<partitionStatTuple::pid>(y));});
+
+  std::vector<int> sendCounts(p, 0);
+  for(auto it = statsVector.begin(); it != statsVector.end(); it++)
+    sendCounts[std::get<partitionStatTuple::pid>(*it) % p]++;
+
+  mxx::all2all(statsVector, sendCounts, comm).swap(statsVector);
+
+  //Sum up the partial counts received from different ranks
+  static layer_comparator<partitionStatTuple::pid, partitionStat_t> pidCmp;
+  std::sort(statsVector.begin(), statsVector.end(), pidCmp);
+
+  std::vector<partitionStat_t> mergedStats;
+  for(auto it = statsVector.begin(); it != statsVector.end();)
+  {
+    auto innerLoopBound = findRange(it, statsVector.end(), *it, pidCmp);
+
+    partitionStat_t stat(std::get<partitionStatTuple::pid>(*it), 0, 0);
+    for(auto it2 = innerLoopBound.first; it2 != innerLoopBound.second; it2++)
+    {
+      std::get<partitionStatTuple::reads>(stat) += std::get<partitionStatTuple::reads>(*it2);
+      std::get<partitionStatTuple::kmers>(stat) += std::get<partitionStatTuple::kmers>(*it2);
+    }
+    mergedStats.push_back(stat);
+
+    it = innerLoopBound.second;
+  }
+
+  return mergedStats;
+}
+
+/*
+ * @brief                       Computes the read and kmer count of every partition
+ * @param[in] localVector       Read sequence tuples with pids, in any order
+ * @return                      Statistics of the partitions with pid % p == rank, sorted by pid.
+ *                              Every partition is listed by exactly one rank
+ */
+template <typename Q>
+std::vector<partitionStat_t> computePartitionStats(const std::vector<Q>& localVector, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  //Partial counts of the partitions that have reads on this rank
+  std::unordered_map<PidType, std::pair<uint64_t, uint64_t>> localCounts;
+  for(auto it = localVector.begin(); it != localVector.end(); it++)
+  {
+    auto& counts = localCounts[std::get<readTuple::pid>(*it)];
+    counts.first++;
+
+    //Kmers of length KMER_LEN in this read
+    if(std::get<readTuple::cnt>(*it) >= KMER_LEN)
+      counts.second += std::get<readTuple::cnt>(*it) - KMER_LEN + 1;
+  }
+
+  std::vector<partitionStat_t> statsVector;
+  statsVector.reserve(localCounts.size());
+  for(auto it = localCounts.begin(); it != localCounts.end(); it++)
+    statsVector.emplace_back(it->first, it->second.first, it->second.second);
+
+  std::unordered_map<PidType, std::pair<uint64_t, uint64_t>>().swap(localCounts);
+
+  return mergePartitionStats(statsVector, comm);
+}
+
+/*
+ * @brief     Placement of partitions on ranks for the assembly phase
+ * @details   Expensive partitions are listed explicitly, every other partition goes to rank pid % p.
+ *            Same on all the ranks
+ */
+struct PartitionSchedule
+{
+  int p;
+
+  //Pairs of <PartitionId, Rank>, sorted by pid
+  std::vector<std::pair<PidType, int>> heavyPartitions;
+
+  //Rank which assembles the given partition
+  int owner(PidType pid) const
+  {
+    auto it = std::lower_bound(heavyPartitions.begin(), heavyPartitions.end(), std::make_pair(pid, 0));
+
+    if(it != heavyPartitions.end() && it->first == pid)
+      return it->second;
+    else
+      return pid % p;
+  }
+};
+
+/*
+ * @brief                       Decides which rank assembles which partition
+ * @param[in] statsVector       Output of computePartitionStats()
+ * @details
+ *            1.  Partitions that cost more than 1/(SCHEDULE_GRANULARITY * p) of the total are heavy,
+ *                the others stay at rank pid % p. Pids are hashed, so these spread evenly
+ *            2.  Gather the heavy partitions on all ranks along with the load of light partitions per rank
+ *            3.  Longest processing time first: assign heavy partitions in decreasing cost order,
+ *                each to the rank with least load so far
+ */
+inline PartitionSchedule computeAssemblySchedule(const std::vector<partitionStat_t>& statsVector, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank, p;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &p);
+
+  PartitionSchedule schedule;
+  schedule.p = p;
+
+  double localCost = 0.0;
+  for(auto it = statsVector.begin(); it != statsVector.end(); it++)
+    localCost += estimateAssemblyCost(std::get<partitionStatTuple::reads>(*it), std::get<partitionStatTuple::kmers>(*it));
+
+  double totalCost = mxx::allreduce(localCost, comm);
+  double heavyThreshold = totalCost / (SCHEDULE_GRANULARITY * p);
+
+  //Pairs of <Cost, PartitionId>
+  std::vector<std::pair<double, PidType>> localHeavy;
+  double lightLoad = 0.0;
+
+  for(auto it = statsVector.begin(); it != statsVector.end(); it++)
+  {
+    double cost = estimateAssemblyCost(std::get<partitionStatTuple::reads>(*it), std::get<partitionStatTuple::kmers>(*it));
+
+    if(cost > heavyThreshold)
+      localHeavy.emplace_back(cost, std::get<partitionStatTuple::pid>(*it));
+    else
+      lightLoad += cost;
+  }
+
+  //At most SCHEDULE_GRANULARITY * p heavy partitions exist
+  auto allHeavy = mxx::allgatherv(localHeavy, comm);
+  auto rankLoads = mxx::allgather(lightLoad, comm);
+
+  //Decreasing cost, ties broken by pid to get the same order on all ranks
+  std::sort(allHeavy.begin(), allHeavy.end(),
+      [](const std::pair<double, PidType>& x, const std::pair<double, PidType>& y){
+      return x.first > y.first || (x.first == y.first && x.second < y.second);});
+
+  //Min-heap of <Load, Rank>
+  typedef std::pair<double, int> rankLoad_t;
+  std::priority_queue<rankLoad_t, std::vector<rankLoad_t>, std::greater<rankLoad_t>> leastLoadedRank;
+  for(int i = 0; i < p; i++)
+    leastLoadedRank.emplace(rankLoads[i], i);
+
+  schedule.heavyPartitions.reserve(allHeavy.size());
+  for(auto it = allHeavy.begin(); it != allHeavy.end(); it++)
+  {
+    auto r = leastLoadedRank.top();
+    leastLoadedRank.pop();
+
+    schedule.heavyPartitions.emplace_back(it->second, r.second);
+    leastLoadedRank.emplace(r.first + it->first, r.second);
+  }
+
+  std::sort(schedule.heavyPartitions.begin(), schedule.heavyPartitions.end());
+
+#if DEBUGLOG
+  if(!rank)
+  {
+    double maxLoad = 0.0;
+    while(!leastLoadedRank.empty())
+    {
+      maxLoad = std::max(maxLoad, leastLoadedRank.top().first);
+      leastLoadedRank.pop();
+    }
+    std::cerr << "Scheduled " << allHeavy.size() << " heavy partitions, estimated max rank load "
+      << maxLoad << " against average " << totalCost / p << "\n";
+  }
+#endif
+
+  return schedule;
+}
+
+/*
+ * @brief                         Moves every read to the rank which assembles its partition
+ * @param[in/out] localVector     Read sequence tuples, returned sorted by pid
+ */
+template <typename Q>
+void sendReadsToPartitionOwners(std::vector<Q>& localVector, const PartitionSchedule& schedule, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int p;
+  MPI_Comm_size(comm, &p);
+
+  //Owner of every read, looked up once
+  std::vector<int> owners(localVector.size());
+  std::vector<int> sendCounts(p, 0);
+  for(std::size_t i = 0; i < localVector.size(); i++)
+  {
+    owners[i] = schedule.owner(std::get<readTuple::pid>(localVector[i]));
+    sendCounts[owners[i]]++;
+  }
+
+  //Reads destined to the same rank become adjacent by a scatter into per owner buckets
+  std::vector<std::size_t> bucketStart(p + 1, 0);
+  for(int i = 0; i < p; i++)
+    bucketStart[i + 1] = bucketStart[i] + sendCounts[i];
+
+  {
+    std::vector<std::size_t> bucketNext(bucketStart.begin(), bucketStart.end() - 1);
+    std::vector<Q> scattered(localVector.size());
+    for(std::size_t i = 0; i < localVector.size(); i++)
+      scattered[bucketNext[owners[i]]++] = localVector[i];
+
+    std::vector<int>().swap(owners);
+    localVector.swap(scattered);
+  }
+
+  //Only a bucket is ordered by pid, reads of a partition stay in read id order as in the contiguous layout
+  for(int i = 0; i < p; i++)
+    std::sort(localVector.begin() + bucketStart[i], localVector.begin() + bucketStart[i + 1],
+        [](const Q& x, const Q& y){
+        return std::make_pair(std::get<readTuple::pid>(x), std::get<readTuple::rid>(x))
+             < std::make_pair(std::get<readTuple::pid>(y), std::get<readTuple::rid>(y));});
+
+  mxx::all2all(localVector, sendCounts, comm).swap(localVector);
+
+  //Received reads are sorted per source rank only
+  static layer_comparator<readTuple::pid, Q> pidCmp;
+  std::stable_sort(localVector.begin(), localVector.end(), pidCmp);
+}
+
+#endif
@@ -0,0 +1,470 @@
+#ifndef PARTITION_STORE_HPP
+#define PARTITION_STORE_HPP
+
+//Includes
+#include <mpi.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//Includes from mxx library
+#include <mxx/sort.hpp>
+
+//Own includes
+#include "sortTuples.hpp"
+#include "configParam.hpp"
+
+/*
+ * PARTITION STORE, a persistent copy of the partitioned reads for running assemblers later
+ *
+ * Files with a common prefix :
+ *   <prefix>.reads.<g>   Packed reads written by the ranks of group g, i.e. ranks [g * PARTITION_STORE_RANKS_PER_FILE, ..)
+ *                        A header is followed by fixed size records of (read id : 8 bytes, length : 4 bytes,
+ *                        4 bytes of padding, packed sequence : nWords words), reads of a partition are adjacent
+ *   <prefix>.index       A header is followed by entries of (pid, file g, first record, count of reads, count of kmers),
+ *                        each a 64 bit integer, sorted by pid. A partition spanning ranks has one entry for every
+ *                        rank holding part of it, readers merge the entries of a pid
+ * Integers are in the byte order of the writer, see endianCheck
+ * With PARTITION_STORE_SPLIT_PIECES in flags, partitions may share kmers, see splitGiantComponent()
+ */
+
+//Header at the beginning of every file of the store
+struct PartitionStoreHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t bitsPerChar;
+  uint32_t wordBytes;
+  uint32_t nWords;
+  uint32_t maxReadSize;
+  uint32_t fileCount;
+
+  //Count of records in a reads file, count of entries in the index
+  uint64_t count;
+  uint64_t endianCheck;
+  uint32_t flags;
+  char padding[12];
+};
+static_assert(sizeof(PartitionStoreHeader) == 64, "Store header should take 64 bytes");
+
+const char PARTITION_STORE_MAGIC[8] = {'M', 'E', 'T', 'A', 'G', 'P', 'S', '1'};
+const uint32_t PARTITION_STORE_VERSION = 1;
+const uint64_t PARTITION_STORE_ENDIAN_CHECK = 0x0102030405060708ULL;
+
+//Flag set when the largest partition was split into pieces, which share the kmers removed between them.
+//Such partitions should not be assembled together
+const uint32_t PARTITION_STORE_SPLIT_PIECES = 1;
+
+//Count of 64 bit integers in an index entry and their order
+const int PARTITION_INDEX_FIELDS = 5;
+class partitionIndexTuple {
+  public:
+    static const uint8_t pid = 0, file = 1, offset = 2, reads = 3, kmers = 4;
+};
+
+//Bytes of read id and length in front of the packed sequence in a record
+const std::size_t PARTITION_RECORD_PREFIX_BYTES = 16;
+
+inline std::string partitionStoreReadsFile(const std::string& prefix, int fileId)
+{
+  return prefix + ".reads." + std::to_string(fileId);
+}
+
+inline std::string partitionStoreIndexFile(const std::string& prefix)
+{
+  return prefix + ".index";
+}
+
+template <typename ReadInf>
+PartitionStoreHeader makePartitionStoreHeader(uint32_t fileCount, uint64_t count, uint32_t flags)
+{
+  PartitionStoreHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, PARTITION_STORE_MAGIC, sizeof(header.magic));
+  header.version = PARTITION_STORE_VERSION;
+  header.bitsPerChar = ReadInf::bitsPerChar;
+  header.wordBytes = sizeof(typename ReadInf::ReadWordType);
+  header.nWords = ReadInf::nWords;
+  header.maxReadSize = ReadInf::maxCharCount;
+  header.fileCount = fileCount;
+  header.count = count;
+  header.endianCheck = PARTITION_STORE_ENDIAN_CHECK;
+  header.flags = flags;
+  return header;
+}
+
+/*
+ * @brief     At the moment, partition with smaller ids tend to be larger.
+ *            To resolve this issue, partition ids are shuffled using XOR function
+ *            The function is a bijection, so different partitions keep different ids.
+ *            The overload for the width of PidType is used. Shuffled ids are the ids the outputs list
+ *            partitions under : the partition store, the ledger, the summaries and the classifier index
+ */
+inline uint32_t hashPartitionId(uint32_t x)
+{
+  //Source : http://stackoverflow.com/questions/664014/what-integer-hash-function-are-good-that-accepts-an-integer-hash-key
+  x = ((x >> 16) ^ x) * 0x45d9f3b;
+  x = ((x >> 16) ^ x) * 0x45d9f3b;
+  x = ((x >> 16) ^ x);
+  return x;
+}
+
+inline uint64_t hashPartitionId(uint64_t x)
+{
+  //Same source, 64 bit variant
+  x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+  x = x ^ (x >> 31);
+  return x;
+}
+
+/*
+ * @brief                 Writes the bytes of all the ranks of comm at their offsets, collective
+ * @details               Collective writes need the same count of calls on all the ranks, and each call writes under 2^31 bytes
+ */
+inline void writeAtAllInRounds(MPI_File fh, uint64_t offset, const char* data, uint64_t localBytes, MPI_Comm comm)
+{
+  const uint64_t chunkBytes = 1 << 30;
+  uint64_t localRounds = (localBytes + chunkBytes - 1) / chunkBytes, rounds = 0;
+  MPI_Allreduce(&localRounds, &rounds, 1, MPI_UINT64_T, MPI_MAX, comm);
+
+  for(uint64_t round = 0, written = 0; round < rounds; round++)
+  {
+    int bytes = std::min(chunkBytes, localBytes - written);
+    MPI_File_write_at_all(fh, offset + written, data + written, bytes, MPI_BYTE, MPI_STATUS_IGNORE);
+    written += bytes;
+  }
+}
+
+inline void writeAtAllInRounds(MPI_File fh, uint64_t offset, const std::vector<char>& buffer, MPI_Comm comm)
+{
+  writeAtAllInRounds(fh, offset, buffer.data(), buffer.size(), comm);
+}
+
+/*
+ * @brief     Writes batches of partitioned reads to a partition store with MPI-IO, see above for the format
+ * @details   Ranks are split into groups of PARTITION_STORE_RANKS_PER_FILE, each group shares a reads file
+ *            and appends every batch to it with collective writes at offsets from prefix sums.
+ *            Index entries are kept in memory, and close() writes them sorted by pid
+ *            Usage : construct on all ranks, write() every batch, then close(), all collective
+ */
+template <typename ReadInf>
+class PartitionStoreWriter
+{
+  private:
+
+    std::string prefix;
+    MPI_Comm comm, groupComm;
+    int fileId, fileCount;
+    uint32_t flags;
+    MPI_File fh;
+
+    //Records written to the group's file so far
+    uint64_t recordCount;
+
+    //Index entries of the reads written by this rank
+    std::vector<std::tuple<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>> indexEntries;
+
+    static constexpr std::size_t recordBytes = PARTITION_RECORD_PREFIX_BYTES + ReadInf::nWords * sizeof(typename ReadInf::ReadWordType);
+
+  public:
+
+    /*
+     * @param[in] flags_    Written to the headers, see PARTITION_STORE_SPLIT_PIECES
+     */
+    PartitionStoreWriter(const std::string& prefix_, uint32_t flags_, MPI_Comm comm_ = MPI_COMM_WORLD)
+      : prefix(prefix_), comm(comm_), flags(flags_), recordCount(0)
+    {
+      int rank, p;
+      MPI_Comm_rank(comm, &rank);
+      MPI_Comm_size(comm, &p);
+
+      fileId = rank / PARTITION_STORE_RANKS_PER_FILE;
+      fileCount = (p + PARTITION_STORE_RANKS_PER_FILE - 1) / PARTITION_STORE_RANKS_PER_FILE;
+
+      MPI_Comm_split(comm, fileId, rank, &groupComm);
+
+      std::string filename = partitionStoreReadsFile(prefix, fileId);
+      MPI_File_open(groupComm, filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+
+      //Stale content of an older, bigger store should not remain
+      MPI_File_set_size(fh, sizeof(PartitionStoreHeader));
+    }
+
+    /*
+     * @brief                     Appends a batch of reads to the store, collective
+     * @param[in] localVector     Read sequence tuples, sorted by pid as placed by placeReadsForAssembly()
+     */
+    template <typename Q>
+    void write(const std::vector<Q>& localVector)
+    {
+      uint64_t localRecords = localVector.size(), firstRecord = 0, groupRecords = 0;
+      MPI_Exscan(&localRecords, &firstRecord, 1, MPI_UINT64_T, MPI_SUM, groupComm);
+      int groupRank;
+      MPI_Comm_rank(groupComm, &groupRank);
+      if(!groupRank) firstRecord = 0;
+      MPI_Allreduce(&localRecords, &groupRecords, 1, MPI_UINT64_T, MPI_SUM, groupComm);
+
+      firstRecord += recordCount;
+
+      std::vector<char> buffer(localRecords * recordBytes, 0);
+      char* record = buffer.data();
+      for(auto it = localVector.begin(); it != localVector.end(); it++, record += recordBytes)
+      {
+        uint64_t rid = std::get<readTuple::rid>(*it);
+        uint32_t length = std::get<readTuple::cnt>(*it);
+        std::memcpy(record, &rid, sizeof(rid));
+        std::memcpy(record + sizeof(rid), &length, sizeof(length));
+        std::memcpy(record + PARTITION_RECORD_PREFIX_BYTES, std::get<readTuple::seq>(*it).data(), recordBytes - PARTITION_RECORD_PREFIX_BYTES);
+      }
+
+      writeAtAllInRounds(fh, sizeof(PartitionStoreHeader) + firstRecord * recordBytes, buffer, groupComm);
+      std::vector<char>().swap(buffer);
+
+      //One index entry for every partition
+      static layer_comparator<readTuple::pid, Q> pidCmp;
+      for(auto it = localVector.begin(); it != localVector.end();)
+      {
+        auto innerLoopBound = findRange(it, localVector.end(), *it, pidCmp);
+
+        uint64_t kmerCount = 0;
+        for(auto it2 = innerLoopBound.first; it2 != innerLoopBound.second; it2++)
+          if(std::get<readTuple::cnt>(*it2) >= KMER_LEN)
+            kmerCount += std::get<readTuple::cnt>(*it2) - KMER_LEN + 1;
+
+        indexEntries.emplace_back(std::get<readTuple::pid>(*it), fileId,
+            firstRecord + (innerLoopBound.first - localVector.begin()),
+            innerLoopBound.second - innerLoopBound.first, kmerCount);
+
+        it = innerLoopBound.second;
+      }
+
+      recordCount += groupRecords;
+    }
+
+    //Writes the headers and the index, collective
+    void close()
+    {
+      int rank, groupRank;
+      MPI_Comm_rank(comm, &rank);
+      MPI_Comm_rank(groupComm, &groupRank);
+
+      PartitionStoreHeader header = makePartitionStoreHeader<ReadInf>(fileCount, recordCount, flags);
+      if(!groupRank)
+        MPI_File_write_at(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+      MPI_File_close(&fh);
+      MPI_Comm_free(&groupComm);
+
+      //Entries of a partition written by different ranks become adjacent, in file order
+      mxx::sort(indexEntries.begin(), indexEntries.end(),
+          [](const std::tuple<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>& x, const std::tuple<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>& y){
+          return x < y;}, comm, false);
+
+      std::vector<char> buffer(indexEntries.size() * PARTITION_INDEX_FIELDS * sizeof(uint64_t));
+      uint64_t* entry = reinterpret_cast<uint64_t*>(buffer.data());
+      for(auto it = indexEntries.begin(); it != indexEntries.end(); it++, entry += PARTITION_INDEX_FIELDS)
+      {
+        entry[partitionIndexTuple::pid] = std::get<partitionIndexTuple::pid>(*it);
+        entry[partitionIndexTuple::file] = std::get<partitionIndexTuple::file>(*it);
+        entry[partitionIndexTuple::offset] = std::get<partitionIndexTuple::offset>(*it);
+        entry[partitionIndexTuple::reads] = std::get<partitionIndexTuple::reads>(*it);
+        entry[partitionIndexTuple::kmers] = std::get<partitionIndexTuple::kmers>(*it);
+      }
+
+      uint64_t localEntries = indexEntries.size(), firstEntry = 0, totalEntries = 0;
+      MPI_Exscan(&localEntries, &firstEntry, 1, MPI_UINT64_T, MPI_SUM, comm);
+      if(!rank) firstEntry = 0;
+      MPI_Allreduce(&localEntries, &totalEntries, 1, MPI_UINT64_T, MPI_SUM, comm);
+      std::vector<std::tuple<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>>().swap(indexEntries);
+
+      std::string filename = partitionStoreIndexFile(prefix);
+      MPI_File indexFh;
+      MPI_File_open(comm, filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &indexFh);
+      MPI_File_set_size(indexFh, sizeof(PartitionStoreHeader) + totalEntries * PARTITION_INDEX_FIELDS * sizeof(uint64_t));
+
+      header = makePartitionStoreHeader<ReadInf>(fileCount, totalEntries, flags);
+      if(!rank)
+        MPI_File_write_at(indexFh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+
+      writeAtAllInRounds(indexFh, sizeof(PartitionStoreHeader) + firstEntry * PARTITION_INDEX_FIELDS * sizeof(uint64_t), buffer, comm);
+      MPI_File_close(&indexFh);
+
+      if(!rank)
+        std::cout << "Partition store written with prefix " << prefix << ", " << totalEntries << " index entries in " << fileCount << " reads files\n";
+    }
+};
+
+/*
+ * @brief     Read only access to a partition store through mmap, for tools which run without MPI
+ * @details   Only the index is read at open(), reads files are mapped on first use and the pages
+ *            of a partition are loaded only when its reads are visited
+ */
+class PartitionStoreReader
+{
+  private:
+
+    struct MappedFile
+    {
+      const char* data;
+      std::size_t bytes;
+    };
+
+    std::string prefix;
+    MappedFile index;
+    std::vector<MappedFile> readsFiles;
+    PartitionStoreHeader header;
+
+    static bool mapFile(const std::string& filename, MappedFile& file)
+    {
+      file.data = nullptr;
+      file.bytes = 0;
+
+      int fd = ::open(filename.c_str(), O_RDONLY);
+      if(fd == -1)
+        return false;
+
+      struct stat st;
+      if(fstat(fd, &st) != 0 || (std::size_t)st.st_size < sizeof(PartitionStoreHeader))
+      {
+        ::close(fd);
+        return false;
+      }
+
+      void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if(addr == MAP_FAILED)
+        return false;
+
+      file.data = static_cast<const char*>(addr);
+      file.bytes = st.st_size;
+      return true;
+    }
+
+    static void unmapFile(MappedFile& file)
+    {
+      if(file.data != nullptr)
+        munmap(const_cast<char*>(file.data), file.bytes);
+      file.data = nullptr;
+    }
+
+    const uint64_t* entry(std::size_t i) const
+    {
+      return reinterpret_cast<const uint64_t*>(index.data + sizeof(PartitionStoreHeader)) + i * PARTITION_INDEX_FIELDS;
+    }
+
+  public:
+
+    //An entry of the index, i.e. reads of a partition in one reads file
+    struct Extent
+    {
+      uint64_t pid, file, offset, reads, kmers;
+    };
+
+    PartitionStoreReader() : index{nullptr, 0} {}
+
+    ~PartitionStoreReader()
+    {
+      unmapFile(index);
+      for(auto& file : readsFiles)
+        unmapFile(file);
+    }
+
+    /*
+     * @brief     Maps the index of the store, returns false with a message in error if it can not be used
+     */
+    bool open(const std::string& prefix_, std::string& error)
+    {
+      prefix = prefix_;
+
+      if(!mapFile(partitionStoreIndexFile(prefix), index))
+      {
+        error = "Can not open " + partitionStoreIndexFile(prefix);
+        return false;
+      }
+
+      std::memcpy(&header, index.data, sizeof(header));
+      if(std::memcmp(header.magic, PARTITION_STORE_MAGIC, sizeof(header.magic)) != 0 || header.version != PARTITION_STORE_VERSION)
+        error = "Not a partition store index";
+      else if(header.endianCheck != PARTITION_STORE_ENDIAN_CHECK)
+        error = "Partition store was written with a different byte order";
+      else if(index.bytes < sizeof(header) + header.count * PARTITION_INDEX_FIELDS * sizeof(uint64_t))
+        error = "Partition store index is truncated";
+      else
+      {
+        readsFiles.assign(header.fileCount, MappedFile{nullptr, 0});
+        return true;
+      }
+
+      unmapFile(index);
+      return false;
+    }
+
+    const PartitionStoreHeader& info() const
+    {
+      return header;
+    }
+
+    std::size_t extentCount() const
+    {
+      return header.count;
+    }
+
+    Extent extent(std::size_t i) const
+    {
+      const uint64_t* e = entry(i);
+      return Extent{e[partitionIndexTuple::pid], e[partitionIndexTuple::file], e[partitionIndexTuple::offset],
+                    e[partitionIndexTuple::reads], e[partitionIndexTuple::kmers]};
+    }
+
+    //Range [first, last) of the extents of the partition, empty if absent
+    std::pair<std::size_t, std::size_t> find(uint64_t pid) const
+    {
+      std::size_t lo = 0, hi = header.count;
+      while(lo < hi)
+      {
+        std::size_t mid = lo + (hi - lo) / 2;
+        if(entry(mid)[partitionIndexTuple::pid] < pid)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+
+      std::size_t last = lo;
+      while(last < header.count && entry(last)[partitionIndexTuple::pid] == pid)
+        last++;
+
+      return std::make_pair(lo, last);
+    }
+
+    //Size of a record in the reads files
+    std::size_t recordBytes() const
+    {
+      return PARTITION_RECORD_PREFIX_BYTES + header.nWords * header.wordBytes;
+    }
+
+    /*
+     * @brief     Pointer to the first record of the extent, nullptr if its reads file can not be mapped
+     * @details   A record holds the read id (uint64_t), the length (uint32_t) and the packed sequence
+     *            at offset PARTITION_RECORD_PREFIX_BYTES
+     */
+    const char* records(const Extent& e)
+    {
+      if(e.file >= readsFiles.size())
+        return nullptr;
+
+      MappedFile& file = readsFiles[e.file];
+      if(file.data == nullptr && !mapFile(partitionStoreReadsFile(prefix, e.file), file))
+        return nullptr;
+
+      if(sizeof(PartitionStoreHeader) + (e.offset + e.reads) * recordBytes() > file.bytes)
+        return nullptr;
+
+      return file.data + sizeof(PartitionStoreHeader) + e.offset * recordBytes();
+    }
+};
+
+#endif
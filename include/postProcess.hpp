@@ -3,6 +3,8 @@
 
 //Includes
 #include <mpi.h>
+#include <deque>
+#include <memory>
 
 //Includes from mxx library
 #include <mxx/sort.hpp>
@@ -12,296 +14,230 @@
 #include "configParam.hpp"
 #include "configPath.hpp"
 #include "packedRead.hpp"
+#include "partitionSchedule.hpp"
+#include "assemblerPool.hpp"
+#include "miniAssembler.hpp"
+#include "partitionStore.hpp"
+#include "assemblyLedger.hpp"
+#include "utils.hpp"
 
 /*
- * @brief     Takes the kmer-pid tuples as input and spits out read-pid tuples as output
+ * @brief     Takes the read tags left by the partitioning phase as input and spits out read-pid tuples as output
  * @details   
- *            1. Parse the file again to generate first_kmer-MAX-readId tuples and append to original vector
- *            2. Sort the vector by kmers and for each MAX tuple, append the new tuples with readId-Pid to a new vector
- *            3. The format of new tuples should be emptyread-readid-pid-0
- *            4. delete the original localVector, and return the new tuples 
+ *            Every read tag (READ_TAG | readId, Pn, Pc) keeps the read id in its kmer layer and the final
+ *            partition id of the read in its Pc layer, so the mapping is a local scan
+ *            The format of new tuples should be readid-pid
  */
-template <typename KmerType, typename T, typename Q>
-void generateReadToPartitionMapping(  cmdLineParams& cmdLineVals,
-                                      std::vector<T>& localVector, std::vector<Q>& newlocalVector, 
-                                      std::vector<bool>& readFilterFlags,
-                                      std::vector<ReadLenType>& readTrimLengths,
-                                      MPI_Comm comm = MPI_COMM_WORLD)
+template <typename T, typename R>
+void generateReadToPartitionMapping(  std::vector<T>& readTagVector, std::vector<R>& readPidVector)
 {
-  int rank;
-  MPI_Comm_rank(comm, &rank);
-
-  //temporary vector for appending reads (first kmers) to localVector
-  std::vector<T> localVector2;
-
-  //Parse the first kmers of each read and keep in localVector2
-  readFASTQFile< KmerType, includeFirstKmersinFilteredReads<KmerType> > (cmdLineVals, localVector2, readFilterFlags, readTrimLengths);
-
-  //Paste all the values into original vector
-  localVector.insert(localVector.end(), localVector2.begin(), localVector2.end());
-  localVector2.clear();
-
-  static layer_comparator<kmerTuple::kmer, T> kmerCmp;
-
-  //Sort by kmer Layer
-  mxx::block_decompose(localVector, comm);
-  mxx::sort(localVector.begin(), localVector.end(), kmerCmp, comm, true); 
+  readPidVector.reserve(readPidVector.size() + readTagVector.size());
 
-  //First resolve the first and last buckets
-  //Vector for containing tuples with pids of leftmost and rightmost buckets
-  std::vector<T> kmerIdsToSend(2);
-  std::vector<T> kmerIdsReceived(2);
-
-  //Disable the effect of these entries by default by setting MAX in the PnLayer 
-  //Rationale: This rank might not contain valid Pid for boundary buckets
-  std::get<kmerTuple::Pn>(kmerIdsToSend[0]) = MAX;  std::get<kmerTuple::Pn>(kmerIdsToSend[1]) = MAX;
-  
-
-  //First bucket's range
-  auto firstBucketBound = findRange(localVector.begin(), localVector.end(), *(localVector.begin()), kmerCmp);
-
-  for(auto it = firstBucketBound.first; it != firstBucketBound.second; it++)
+  for(auto it = readTagVector.begin(); it != readTagVector.end(); it++)
   {
-    //If there is a tuple containing the valid partition id for this kmer
-    if(std::get<kmerTuple::Pn>(*it) != MAX)
-    {
-      //Save this tuple
-      kmerIdsToSend[0] = *it;
-    }
-  }
+    R newTuple;
+    std::get<readPidTuple::rid>(newTuple) = std::get<kmerTuple::kmer>(*it) & ~READ_TAG;
+    std::get<readPidTuple::pid>(newTuple) = std::get<kmerTuple::Pc>(*it);
 
-  //Repeat the same process with rightmost bucket
-  auto lastBucketBound = findRange(localVector.rbegin(), localVector.rend(), *(localVector.rbegin()), kmerCmp);
-  for(auto it = lastBucketBound.first; it != lastBucketBound.second; it++)
-  {
-    //If there is a tuple containing the valid partition id for this kmer
-    if(std::get<kmerTuple::Pn>(*it) != MAX)
-    {
-      //Save this tuple
-      kmerIdsToSend[1] = *it;
-    }
+    //Push this tuple to new vector
+    readPidVector.push_back(newTuple);
   }
+}
 
-  //Do the communication and get the partitionids for boundary partitions
-  //We do the MPI exscan on rightMostKmersIdSend to get the ids for our bucket, higher rank 
-
-  std::vector<T> gatherkmerIds = mxx::allgatherv(kmerIdsToSend, comm);
+/*
+ * @brief                         Sends every read-pid tuple to the rank which parsed the read during FASTQ parsing
+ * @param[in] readIdOffsets       First read id of every rank, see getReadIdOffsets()
+ * @param[in/out] readPidVector   Returns the tuples of the reads parsed by this rank, sorted by read id
+ */
+template <typename R>
+void sendReadPidsToReadOwners(std::vector<R>& readPidVector, const std::vector<ReadIdType>& readIdOffsets, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int p;
+  MPI_Comm_size(comm, &p);
 
-  //Fetch the correct leftmost and rightmost ids using the values gathered above
-  kmerIdsReceived[0] = *(std::find_if(gatherkmerIds.begin(), gatherkmerIds.end(), 
-                                                                              [&localVector = localVector](const T& x){
-                                                                                return (std::get<kmerTuple::kmer>(x) == std::get<kmerTuple::kmer>(localVector.front()) &&
-                                                                                        std::get<kmerTuple::Pn>(x) != MAX);}));
-  kmerIdsReceived[1] = *(std::find_if(gatherkmerIds.begin(), gatherkmerIds.end(), 
-                                                                              [&localVector = localVector](const T& x){
-                                                                                return (std::get<kmerTuple::kmer>(x) == std::get<kmerTuple::kmer>(localVector.back()) &&
-                                                                                        std::get<kmerTuple::Pn>(x) != MAX);}));
+  static layer_comparator<readPidTuple::rid, R> ridCmp;
 
-  //Now we are ready to go through each bucket
-  //For each bucket, we first find the correct pid, then for each read tuple, make new tuple in newlocalVector with appropriate values
+  //Tuples destined to same rank become adjacent
+  std::sort(readPidVector.begin(), readPidVector.end(), ridCmp);
 
-  for(auto it = localVector.begin(); it != localVector.end();)
+  //Count the tuples for each rank using its read id range
+  std::vector<int> sendCounts(p, 0);
+  auto rangeStart = readPidVector.begin();
+  for(int i = 0; i < p; i++)
   {
-    auto innerLoopBound = findRange(it, localVector.end(), *it, kmerCmp);
-    
-    if (innerLoopBound.first == localVector.begin()) // first bucket
-    {
-      //Get the pid from boundary tuple
-      auto correctPid = std::get<kmerTuple::Pc>(kmerIdsReceived[0]);
-
-      //Scan the bucket
-      for(auto it2 = innerLoopBound.first; it2!= innerLoopBound.second; it2++)
-      {
-        if(std::get<kmerTuple::Pn>(*it2) == MAX)
-        {
-          Q newTuple;
-          std::get<readTuple::pid>(newTuple) = correctPid;
-          std::get<readTuple::rid>(newTuple) = std::get<kmerTuple::Pc>(*it2);
-          std::get<readTuple::cnt>(newTuple) = 0;
+    auto rangeEnd = std::lower_bound(rangeStart, readPidVector.end(), readIdOffsets[i+1],
+        [](const R& x, ReadIdType y){
+        return std::get<readPidTuple::rid>(x) < y;});
 
-          //Push this tuple to new vector
-          newlocalVector.push_back(newTuple);
-        }
-      }
-    }
-    else if (innerLoopBound.second == localVector.end()) // last bucket
-    {
-      //Get the pid from boundary tuple
-      auto correctPid = std::get<kmerTuple::Pc>(kmerIdsReceived[1]);
-
-      //Scan the bucket
-      for(auto it2 = innerLoopBound.first; it2!= innerLoopBound.second; it2++)
-      {
-        if(std::get<kmerTuple::Pn>(*it2) == MAX)
-        {
-          Q newTuple;
-          std::get<readTuple::pid>(newTuple) = correctPid;
-          std::get<readTuple::rid>(newTuple) = std::get<kmerTuple::Pc>(*it2);
-          std::get<readTuple::cnt>(newTuple) = 0;
-
-          //Push this tuple to new vector
-          newlocalVector.push_back(newTuple);
-        }
-      }
-    }
-    else if (innerLoopBound.first != localVector.begin() && innerLoopBound.second != localVector.end()) // middle bucket
-    {
-      //Get the pid from boundary tuple
-      auto findTuple = *(std::find_if(innerLoopBound.first, innerLoopBound.second, 
-                                                                              [](const T& x){
-                                                                                return (std::get<kmerTuple::Pn>(x) != MAX);}));
-
-      auto correctPid = std::get<kmerTuple::Pc>(findTuple);
-
-      //Scan the bucket
-      for(auto it2 = innerLoopBound.first; it2!= innerLoopBound.second; it2++)
-      {
-        if(std::get<kmerTuple::Pn>(*it2) == MAX)
-        {
-          Q newTuple;
-          std::get<readTuple::pid>(newTuple) = correctPid;
-          std::get<readTuple::rid>(newTuple) = std::get<kmerTuple::Pc>(*it2);
-          std::get<readTuple::cnt>(newTuple) = 0;
+    sendCounts[i] = rangeEnd - rangeStart;
+    rangeStart = rangeEnd;
+  }
 
-          //Push this tuple to new vector
-          newlocalVector.push_back(newTuple);
-        }
-      }
-    }
+  mxx::all2all(readPidVector, sendCounts, comm).swap(readPidVector);
 
-    //Move to next bucket
-    it = innerLoopBound.second;
-  }
+  //Received tuples are sorted per source rank only
+  std::sort(readPidVector.begin(), readPidVector.end(), ridCmp);
 }
 
 /*
  * @brief     Given readid-pid as input, this generates vector of tuples with read string sequences and partition id
  * @details
- *            1.  Parse all the read sequences and append new tuples for them, with pid set to MAX in the beginning
- *            2.  Sort the vector by readid, and assign pid to reads by linear scan in each bucket
- *            4.  Convert this vector to a vector having tuples with read sequences and correct pids. The vector should be
- *                sorted by pid in the end
+ *            1.  Send the readid-pid tuples to the ranks which parse the reads
+ *            2.  Parse the read sequences which have a pid, other reads are treated as discarded by the filter.
+ *                Tuples are sorted by read id because read ids grow with the parsing order
+ *            3.  Assign pid to reads by a merge of the two sorted vectors
+ * @param[in] readIdOffsets     First read id of every rank, see getReadIdOffsets()
+ * @NOTE      Reads are left on the ranks which parsed them, see placeReadsForAssembly()
  */
-template <typename KmerType, typename Q> 
+template <typename KmerType, typename R, typename Q> 
 void generateSequencesVector(cmdLineParams& cmdLineVals,
+                             const std::vector<ReadIdType>& readIdOffsets,
+                             std::vector<R>& readPidVector,
                              std::vector<Q>& newLocalVector, std::vector<bool>& readFilterFlags,
                              std::vector<ReadLenType>& readTrimLengths,
                              MPI_Comm comm = MPI_COMM_WORLD)
 {
-  int rank, p;
+  int rank;
   MPI_Comm_rank(comm, &rank);
-  MPI_Comm_size(comm, &p);
-
-  //temporary vector for appending reads (first kmers) to localVector
-  std::vector<Q> newLocalVector2;
 
-  //Parse the first kmers of each read and keep in localVector2
-  readFASTQFile< KmerType, includeWholeReadinFilteredReads<KmerType> > (cmdLineVals, newLocalVector2, readFilterFlags, readTrimLengths);
+  //Bring the pid of every read to the rank which parses its sequence
+  sendReadPidsToReadOwners(readPidVector, readIdOffsets, comm);
 
-  //Paste all the values into original vector
-  newLocalVector.insert(newLocalVector.end(), newLocalVector2.begin(), newLocalVector2.end());
-  newLocalVector2.clear();
-
-  static layer_comparator<readTuple::rid, Q> ridCmp;
-
-  //Sort by read id Layer
-  mxx::block_decompose(newLocalVector, comm);
-  mxx::sort(newLocalVector.begin(), newLocalVector.end(), ridCmp, comm, true); 
-
-  //Now each bucket will have only 2 elements, read tuple with pid and read tuple with sequence.
-  //Goal is to place the sequence in the tuple with correct pid and later remove tuples without pid
-  //Since a bucket could be spilled across processors, we will do a left shift of leftmost element, and push_back it to local vector
-  //Then each bucket is processed only when its size is 2
-
-  Q tupleToShift = newLocalVector.front();
-  Q tupleFromShift = mxx::left_shift(tupleToShift, comm);
-
-  //Last but one processor
-  if(rank < p - 1) 
-    newLocalVector.push_back(tupleFromShift);
-
-  //Start processing the buckets
-  for(auto it = newLocalVector.begin(); it != newLocalVector.end();)
+  //Filter settings which skip the reads without pid
+  std::vector<bool> parseFilterFlags(readFilterFlags.size(), false);
+  std::vector<ReadLenType> parseTrimLengths(readTrimLengths.size(), 0);
+  for(auto it = readPidVector.begin(); it != readPidVector.end(); it++)
   {
-    auto innerLoopBound = findRange(it, newLocalVector.end(), *it, ridCmp);
+    auto localReadId = std::get<readPidTuple::rid>(*it) - readIdOffsets[rank];
+    parseFilterFlags[localReadId] = readFilterFlags[localReadId];
+    parseTrimLengths[localReadId] = readTrimLengths[localReadId];
+  }
 
-    if(innerLoopBound.second - innerLoopBound.first == 2)
-    {
-      //Get the pid from boundary tuple
-      auto findTupleWithSequence = (std::find_if(innerLoopBound.first, innerLoopBound.second, 
-            [](const Q& x){
-            return (std::get<readTuple::pid>(x) == MAX);}));
+  //Parse the whole reads and keep in newLocalVector
+  readFASTQFile< KmerType, includeWholeReadinFilteredReads<KmerType> > (cmdLineVals, newLocalVector, parseFilterFlags, parseTrimLengths);
 
-      auto findTupleWithPid = (std::find_if(innerLoopBound.first, innerLoopBound.second,
-            [](const Q& x){
-            return (std::get<readTuple::pid>(x) != MAX);}));
+  std::vector<bool>().swap(parseFilterFlags);
+  std::vector<ReadLenType>().swap(parseTrimLengths);
 
-      //Update sequence and count
-      std::get<readTuple::seq>(*findTupleWithPid) = std::get<readTuple::seq>(*findTupleWithSequence);
-      std::get<readTuple::cnt>(*findTupleWithPid) = std::get<readTuple::cnt>(*findTupleWithSequence);
+  //Both vectors are sorted by read id
+  //Reads without pid are marked with zero count, because any pid value is valid after shufflePids()
+  auto pidIt = readPidVector.begin();
+  for(auto it = newLocalVector.begin(); it != newLocalVector.end(); it++)
+  {
+    while(pidIt != readPidVector.end() && std::get<readPidTuple::rid>(*pidIt) < std::get<readTuple::rid>(*it))
+      pidIt++;
 
-    }
+    if(pidIt != readPidVector.end() && std::get<readPidTuple::rid>(*pidIt) == std::get<readTuple::rid>(*it))
+      std::get<readTuple::pid>(*it) = std::get<readPidTuple::pid>(*pidIt);
     else
-    {
-      //This tuple is not needed, therefore should be removed later
-      std::get<readTuple::pid>(*innerLoopBound.first) = MAX;
-    }
-
-    //Move to next bucket
-    it = innerLoopBound.second;
+      std::get<readTuple::cnt>(*it) = 0;
   }
 
-  //Now we can get rid of all the tuples who have pid as MAX
+  std::vector<R>().swap(readPidVector);
+
+  //Now we can get rid of all the tuples without pid
   auto cend = std::partition(newLocalVector.begin(), newLocalVector.end(), 
       [](const Q& x){
-      return std::get<readTuple::pid>(x) != MAX;});
+      return std::get<readTuple::cnt>(x) != 0;});
 
   newLocalVector.erase(cend, newLocalVector.end());
+}
 
-  //Sort by partitionId to bring reads in same Pc adjacent
-  static layer_comparator<readTuple::pid, Q> pidCmp;
-  mxx::block_decompose(newLocalVector, comm);
-  mxx::sort(newLocalVector.begin(), newLocalVector.end(), pidCmp, comm, true); 
-
+/*
+ * @brief     Moves the reads to ranks for assembly, this is the only exchange of read sequences
+ * @details   
+ *            lpt :         Partitions are placed by computeAssemblySchedule() to balance the estimated
+ *                          assembly cost among ranks. A partition is never split across ranks
+ *            dynamic :     Same placement as lpt, ranks steal tasks later, see assembleWithWorkStealing()
+ *            contiguous :  Reads are sorted by pid and block decomposed, so ranks get equal read counts
+ *                          and partitions may span over ranks
+ *            Either way, localVector is sorted by pid on return
+ */
+template <typename Q>
+void placeReadsForAssembly(std::vector<Q>& localVector, const std::vector<partitionStat_t>& statsVector,
+                           cmdLineParams &cmdLineVals, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  if(cmdLineVals.assemblySchedule == "contiguous")
+  {
+    //Sort by partitionId to bring reads in same Pc adjacent
+    static layer_comparator<readTuple::pid, Q> pidCmp;
+    mxx::block_decompose(localVector, comm);
+    mxx::sort(localVector.begin(), localVector.end(), pidCmp, comm, true); 
+  }
+  else
+  {
+    PartitionSchedule schedule = computeAssemblySchedule(statsVector, comm);
+    sendReadsToPartitionOwners(localVector, schedule, comm);
+  }
 }
 
 /*
- * @brief                         At the moment, partition with smaller ids tend to be larger.
- *                                To resolve this issue, partition ids are shuffled using XOR function
- * @param[in/out] localVector     Accepts vector which is block decomposed, and returns the vector sorted
- *            
+ * @brief                         Shuffles the partition ids of read-pid tuples, see hashPartitionId()
+ * @details                       Done before the reads are sorted by pid, so that read sequences are
+ *                                exchanged and sorted only once
  */
-template <typename Q> 
-void shuffleAndResortPids(std::vector<Q> &localVector, MPI_Comm comm = MPI_COMM_WORLD)
+template <typename R> 
+void shufflePids(std::vector<R> &readPidVector)
 {
-  std::for_each(localVector.begin(), localVector.end(), 
-      [](Q &t){ 
-          //Source : http://stackoverflow.com/questions/664014/what-integer-hash-function-are-good-that-accepts-an-integer-hash-key
-          PidType x = std::get<readTuple::pid>(t);
-          x = ((x >> 16) ^ x) * 0x45d9f3b;
-          x = ((x >> 16) ^ x) * 0x45d9f3b;
-          x = ((x >> 16) ^ x);
-          std::get<readTuple::pid>(t) = x;
+  std::for_each(readPidVector.begin(), readPidVector.end(), 
+      [](R &t){ 
+          std::get<readPidTuple::pid>(t) = hashPartitionId(std::get<readPidTuple::pid>(t));
       });
+}
 
-  //Sort by partitionId to bring reads in same Pc adjacent
-  static layer_comparator<readTuple::pid, Q> pidCmp;
-  mxx::sort(localVector.begin(), localVector.end(), pidCmp, comm, true);
+/*
+ * @brief                         Removes the read-pid tuples of partitions too small to assemble
+ * @details   Tuples go to rank pid % p, which then holds every read of its partitions and counts them.
+ *            Reads of the removed partitions are never parsed, packed or exchanged afterwards
+ * @param[out] tinyStats          Statistics of the removed partitions for the histogram, kmers are not counted
+ */
+template <typename R>
+void removeTinyPartitions(std::vector<R>& readPidVector, std::vector<partitionStat_t>& tinyStats, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int p;
+  MPI_Comm_size(comm, &p);
+
+  static layer_comparator<readPidTuple::pid, R> pidCmp;
+
+  //Tuples destined to the same rank become adjacent
+  std::sort(readPidVector.begin(), readPidVector.end(),
+      [p](const R& x, const R& y){
+      return std::make_pair(std::get<readPidTuple::pid>(x) % p, std::get<readPidTuple::pid>(x))
+           < std::make_pair(std::get<readPidTuple::pid>(y) % p, std::get<readPidTuple::pid>(y));});
+
+  std::vector<int> sendCounts(p, 0);
+  for(auto it = readPidVector.begin(); it != readPidVector.end(); it++)
+    sendCounts[std::get<readPidTuple::pid>(*it) % p]++;
+
+  mxx::all2all(readPidVector, sendCounts, comm).swap(readPidVector);
+  std::sort(readPidVector.begin(), readPidVector.end(), pidCmp);
+
+  //Keep the tuples of large enough partitions at the front
+  auto keepEnd = readPidVector.begin();
+  for(auto it = readPidVector.begin(); it != readPidVector.end();)
+  {
+    auto innerLoopBound = findRange(it, readPidVector.end(), *it, pidCmp);
+    uint64_t readCount = innerLoopBound.second - innerLoopBound.first;
+
+    if(readCount < MIN_READ_COUNT_FOR_ASSEMBLY)
+      tinyStats.emplace_back(std::get<readPidTuple::pid>(*it), readCount, 0);
+    else
+      keepEnd = std::move(innerLoopBound.first, innerLoopBound.second, keepEnd);
+
+    it = innerLoopBound.second;
+  }
+
+  readPidVector.erase(keepEnd, readPidVector.end());
 }
 
 /*
- * @brief   A separate struct to initialize all the string commands needed to execute velvet assembler.
+ * @brief   A separate struct to initialize all the file names used during parallel assembly.
  *          Final output contigs are saved in the contigs.fa file 
  */
 struct AssemblyCommands
 {
   int rank;
-  std::string filename_fasta, filename_contigs, outputDir, sharedFolder,
-              cmd_create_dir, velvetExe1, velvetExe2,
-              backupContigs, 
-              resetVelvet, resetInput, resetOutput, resetSharedFolder,
-              resetContigTmps,
-              finalMerge;
+  std::string filename_contigs, outputContigFile;
 
   //Constructor
   AssemblyCommands(int rank_, cmdLineParams &cmdLineVals)
@@ -312,308 +248,1088 @@ struct AssemblyCommands
 
   void do_init(cmdLineParams &cmdLineVals)
   {
-    std::string outputContigFile = "contigs.fa";
-    //filename for writing read sequences
-    filename_fasta = localFS + "/reads_" + std::to_string(rank) + ".fasta";
+    outputContigFile = "contigs.fa";
 
     //Velvet writes it output to a directory, contigs are saved in contigs.fa file
     //Need to append those contigs in this rank's main contig file
     filename_contigs = localFS + "/contigs_" + std::to_string(rank) + ".fasta";
+  }
+};
 
-    //Output directory for this rank
-    outputDir = localFS + "/velvetOutput_" + std::to_string(rank);
+//Upper bound of fasta bytes for the given count of reads, used to place assembler input
+inline uint64_t estimateFastaBytes(uint64_t readCount)
+{
+  //Header of a read is '>', read id and a newline
+  return readCount * (MAX_READ_SIZE + std::numeric_limits<ReadIdType>::digits10 + 4);
+}
 
-    //Shared folder to save reads in the boundary partition
-    sharedFolder = sharedFS + "/tmpFolder";
-    cmd_create_dir = "mkdir -p " + outputDir + " " + sharedFolder;
+/*
+ * @brief     Writes the reads in range [first, last) to a fasta stream, read ids are used as headers
+ * @details   Records are formatted in a local buffer, which is written to the stream in bulk
+ */
+template <typename ReadInf, typename Iter>
+void appendReadsToFasta(Iter first, Iter last, std::ofstream& ofs)
+{
+  const std::size_t bufferBytes = 1 << 20;
+  std::string buffer;
+  buffer.reserve(bufferBytes + estimateFastaBytes(1));
 
-    //Executing assembler
-    velvetExe1 = projSrcDir + "/ext/velvet/velveth " + outputDir + " "  + std::to_string(cmdLineVals.velvetKmerSize) +" -short " + filename_fasta + " ";
-    velvetExe2 = projSrcDir + "/ext/velvet/velvetg " + outputDir + " ";
+  char digits[std::numeric_limits<ReadIdType>::digits10 + 1];
 
-    //Assembler's output in the contigs file
-    backupContigs = "cat " + outputDir + "/contigs.fa >> " + filename_contigs;
+  for(auto it = first; it != last; it++)
+  {
+    //Read id digits are generated backwards
+    ReadIdType rid = std::get<readTuple::rid>(*it);
+    int nDigits = 0;
+    do
+    {
+      digits[nDigits++] = '0' + rid % 10;
+      rid /= 10;
+    } while(rid > 0);
 
-    //Remove file/directory after every assemby run
-    resetVelvet = "rm -rf " + outputDir + "/*";
-    resetInput = "> " + filename_fasta;
-    resetContigTmps = "> " + filename_contigs;
-    resetOutput = "rm -rf " + outputContigFile;
-    resetSharedFolder = "rm -rf " + sharedFolder;
+    buffer.push_back('>');
+    while(nDigits > 0)
+      buffer.push_back(digits[--nDigits]);
+    buffer.push_back('\n');
 
-    //Concatenate all the contigs to a single file
-    //Every rank should call this one by one
-    finalMerge = "cat " + filename_contigs +" >> " + outputContigFile; 
+    std::size_t pos = buffer.size();
+    buffer.resize(pos + std::get<readTuple::cnt>(*it));
+    getUnPackedRead<ReadInf>(std::get<readTuple::seq>(*it), std::get<readTuple::cnt>(*it), &buffer[pos]);
+    buffer.push_back('\n');
+
+    if(buffer.size() >= bufferBytes)
+    {
+      ofs.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
   }
 
-  std::string getBoundaryFastaFileName(int rankWhereToSendReads)
+  ofs.write(buffer.data(), buffer.size());
+}
+
+//Distinct pids of the reads in range [first, last), which is sorted by pid
+template <typename Iter>
+std::vector<PidType> partitionIdsInRange(Iter first, Iter last)
+{
+  std::vector<PidType> pids;
+  for(auto it = first; it != last; it++)
+    if(pids.empty() || pids.back() != std::get<readTuple::pid>(*it))
+      pids.push_back(std::get<readTuple::pid>(*it));
+
+  return pids;
+}
+
+//Message tag and chunk size for streaming boundary partitions
+const int BOUNDARY_PARTITION_TAG = 101;
+const int BOUNDARY_CHUNK_READS = 1 << 16;
+
+/*
+ * @brief     Streams the read tuples in range [first, last) to the rank which assembles their partition
+ * @details   Reads are sent packed, as chunks of BOUNDARY_CHUNK_READS tuples with synchronous sends,
+ *            so the receiver never holds more than one chunk. A zero length message ends the stream
+ */
+template <typename Iter>
+void sendBoundaryPartition(Iter first, Iter last, int owner, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  typedef typename std::iterator_traits<Iter>::value_type Q;
+
+  for(auto it = first; it != last; )
   {
-    return sharedFolder + "/reads_" + std::to_string(rankWhereToSendReads) + "_" + std::to_string(rank);
+    int chunk = std::min<std::ptrdiff_t>(BOUNDARY_CHUNK_READS, last - it);
+    MPI_Ssend(&*it, chunk * sizeof(Q), MPI_BYTE, owner, BOUNDARY_PARTITION_TAG, comm);
+    it += chunk;
   }
 
-  std::string catBoundaryFiles(int rankOwner)
+  MPI_Ssend(nullptr, 0, MPI_BYTE, owner, BOUNDARY_PARTITION_TAG, comm);
+}
+
+/*
+ * @brief     Receives the reads streamed by sendBoundaryPartition() and writes them to a fasta stream
+ */
+template <typename ReadInf, typename Q>
+void receiveBoundaryPartition(int sender, std::ofstream& ofs, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  std::vector<Q> chunk(BOUNDARY_CHUNK_READS);
+
+  while(true)
   {
-    std::string files = sharedFolder + "/reads_" + std::to_string(rankOwner) + "_*";
-    return "if ls " + files + " 1> /dev/null 2>&1 ; then cat " + files + " >> " + filename_fasta + "; fi ;"; 
+    MPI_Status status;
+    MPI_Recv(chunk.data(), chunk.size() * sizeof(Q), MPI_BYTE, sender, BOUNDARY_PARTITION_TAG, comm, &status);
+
+    int bytes;
+    MPI_Get_count(&status, MPI_BYTE, &bytes);
+    if(bytes == 0)
+      break;
+
+    appendReadsToFasta<ReadInf>(chunk.begin(), chunk.begin() + bytes / sizeof(Q), ofs);
   }
+}
+
+/*
+ * @brief     Packs small partitions into a single assembler input
+ * @details   Partitions share no kmer of length KMER_LEN, so with velvet kmer size >= KMER_LEN 
+ *            they stay disconnected when assembled together. This doesn't hold for the pieces of a
+ *            split partition, see splitGiantComponent(), batching is off then. Ranges are buffered until 
+ *            they hold readBudget reads, partitions with readBudget reads or more run alone.
+ *            A zero budget disables batching
+ */
+template <typename ReadInf, typename Iter>
+class AssemblyBatch
+{
+  private:
+    AssemblerPool& pool;
+    uint64_t readBudget;
+    uint64_t readCount;
+    std::vector<std::pair<Iter, Iter>> ranges;
+
+  public:
+    AssemblyBatch(AssemblerPool& pool_, uint64_t readBudget_)
+      : pool(pool_), readBudget(readBudget_), readCount(0) {}
+
+    //Adds a partition, returns count of assembler jobs launched
+    int add(Iter first, Iter last)
+    {
+      if((uint64_t)(last - first) >= readBudget)
+      {
+        int slot = pool.acquireSlot();
+        std::ofstream ofs(pool.prepareInput(slot, estimateFastaBytes(last - first)), std::ofstream::out);
+        appendReadsToFasta<ReadInf>(first, last, ofs);
+        ofs.close();
+
+        pool.launch(slot, partitionIdsInRange(first, last));
+        return 1;
+      }
+
+      ranges.emplace_back(first, last);
+      readCount += last - first;
+
+      if(readCount >= readBudget)
+        return flush();
+
+      return 0;
+    }
+
+    //Launches the buffered partitions, returns count of assembler jobs launched
+    int flush()
+    {
+      if(ranges.empty())
+        return 0;
+
+      int slot = pool.acquireSlot();
+      std::vector<PidType> pids;
+      std::ofstream ofs(pool.prepareInput(slot, estimateFastaBytes(readCount)), std::ofstream::out);
+      for(auto& range : ranges)
+      {
+        appendReadsToFasta<ReadInf>(range.first, range.second, ofs);
+
+        auto rangePids = partitionIdsInRange(range.first, range.second);
+        pids.insert(pids.end(), rangePids.begin(), rangePids.end());
+      }
+      ofs.close();
+
+      pool.launch(slot, pids);
+
+      ranges.clear();
+      readCount = 0;
+      return 1;
+    }
 };
 
 /*
- * @brief     With read sequences and pids in the vector (sorted by pid), run parallel assembly using a assembler
+ * @brief     Assembles the partitions with work stealing among ranks, using one-sided MPI
  * @details
- *            1. Iterate over the element of vectors and dump the reads belonging to same partition into fasta file
- *            2. Run assembler and append the contigs to a file local to this processor
- *            3. Merge all the contig files in the end
+ *            1.  Partitions with too few reads are removed, and the ones accepted by mini are assembled
+ *                locally right away. Every remaining partition with batchReadBudget reads or more
+ *                is a task, smaller neighbouring partitions are grouped into tasks as in AssemblyBatch.
+ *                A task is described by its range in localVector. Tasks are ordered largest first
+ *            2.  Each rank exposes a task counter, its task descriptors and its reads in MPI windows
+ *            3.  Whenever the pool has an idle slot, a rank claims the next task of any rank by atomic fetch
+ *                and add on that rank's counter, starting with its own tasks and then visiting the other ranks
+ *                in round robin order. Reads of a claimed remote task are fetched with MPI_Get.
+ *                A rank waiting for an idle slot keeps calling MPI, so that thieves aren't stalled by its jobs
+ *            The loop ends when every task is claimed, so the ranks finish together with the last task
+ * @return    Count of tasks claimed by this rank
+ * @NOTE      Requires localVector to be sorted by pid, with no partition spanning ranks
  */
 template <typename ReadInf, typename Q>
-void runParallelAssembly(std::vector<Q> &localVector, cmdLineParams &cmdLineVals, MPI_Comm comm = MPI_COMM_WORLD)
+int assembleWithWorkStealing(std::vector<Q> &localVector, AssemblerPool& pool, uint64_t batchReadBudget,
+                             MiniAssembler<ReadInf>& mini, MPI_Comm comm = MPI_COMM_WORLD)
 {
   int rank, p;
   MPI_Comm_rank(comm, &rank);
   MPI_Comm_size(comm, &p);
 
-  //Timer to see balance of assembly load among the ranks
-  MP_TIMER_START();
-
-  //Assuming localVector was sorted by pids in the previous step
-
-  //The role of this function is trivial, except that there might be partitions spawning
-  //across multiple ranks. To deal with this, we will handle end boundary partitions as special case
-  
-  //Comparator for computing a partition's range
   static layer_comparator<readTuple::pid, Q> pidCmp;
 
-  AssemblyCommands R(rank, cmdLineVals);
-  //Clean things in case output already exists
-  int i;
-  i = std::system(R.resetVelvet.c_str());
-  i = std::system(R.resetInput.c_str());
-  i = std::system(R.resetContigTmps.c_str());
-  if(!rank) i = std::system(R.resetOutput.c_str());
-  if(!rank) i = std::system(R.resetSharedFolder.c_str());
-
-  //If output directory doesn't exist, create one
-  i = std::system(R.cmd_create_dir.c_str());
-
-  /*
-   * NEED TO DO SOME WORK FOR RESOLVING BOUNDARY PARTITIONS
-   * 1. Partition that spans over more than 1 rank, we will assume the highest rank owns it
-   * 2. Let other ranks who don't own a partition write the reads to a separate file in sharedFolder
-   * 3. Rank which owns the partition would read the partitions and pipe them to its own read fasta file
-   */
-
-  //Ids for first and last partition this rank has
-  std::vector<PidType> boundaryPartitionIds(2);
-  boundaryPartitionIds[0] = std::get<readTuple::pid>(localVector.front());
-  boundaryPartitionIds[1] = std::get<readTuple::pid>(localVector.back());
-
-  auto allBoundaryPartitionIds = mxx::allgatherv(boundaryPartitionIds, comm);
-  
-  //Decide if I owe someone else my last partition
-  bool iShouldTransferLastPartition;
-  int rankToWhom = MAX_INT;
-  //IF : My last partition's Id matches with first partition's id of rank one higher to me
-  if(rank < p - 1 && (allBoundaryPartitionIds[2*rank + 1] == allBoundaryPartitionIds[2*(rank + 1)]) )
+  //Task descriptor <offset, count of reads> in the owner's localVector
+  typedef std::pair<uint64_t, uint64_t> task_t;
+  std::vector<task_t> tasks;
+
+  //Keep the partitions to assemble adjacent
+  auto keepEnd = localVector.begin();
+  for(auto it=localVector.begin(); it!=localVector.end(); )
   {
-    iShouldTransferLastPartition = true;
+    auto innerLoopBound = findRange(it, localVector.end(), *it, pidCmp);
 
-    //Compute which rank to transfer 
-    auto partitionRange = std::equal_range(allBoundaryPartitionIds.begin(), allBoundaryPartitionIds.end(), allBoundaryPartitionIds[2*rank + 1]);
-    auto indexFromStartLastOccurence = std::distance(allBoundaryPartitionIds.begin(), partitionRange.second) - 1; 
-    rankToWhom = ((int)indexFromStartLastOccurence)/2;
-  }
-  else
-    iShouldTransferLastPartition = false;
+    auto partitionSize = innerLoopBound.second - innerLoopBound.first;
 
-  //See if I own my first partition or not
-  bool iDontOwnPartitionFirstPartition;
-  //IF :  I have only 1 partition with me and it needs to be transferred to higher rank
-  if(allBoundaryPartitionIds[2*rank] == allBoundaryPartitionIds[2*rank + 1] && iShouldTransferLastPartition) 
-    iDontOwnPartitionFirstPartition = true;
-  else
-    iDontOwnPartitionFirstPartition = false;
+    if(partitionSize >= MIN_READ_COUNT_FOR_ASSEMBLY && mini.accepts(partitionSize))
+      mini.assemble(innerLoopBound.first, innerLoopBound.second);
+    else if(partitionSize >= MIN_READ_COUNT_FOR_ASSEMBLY)
+      keepEnd = std::move(innerLoopBound.first, innerLoopBound.second, keepEnd);
 
-  //To write sequence to file
-  std::ofstream ofs;
+    it = innerLoopBound.second;
+  }
+  localVector.erase(keepEnd, localVector.end());
 
-  //Save last partition to a file
-  //Note that we could have done mpi communication here, but high imbalance among read partitions
-  //could lead to runtime memory errors
-  if(iShouldTransferLastPartition)
-  {
-    auto innerLoopBound = findRange(localVector.rbegin(), localVector.rend(), localVector.back(), pidCmp);
-    ofs.open(R.getBoundaryFastaFileName(rankToWhom),std::ofstream::out);
+  //Open task which collects small partitions
+  task_t batch(0, 0);
 
-    int countReadsShared = 0;
+  for(auto it=localVector.begin(); it!=localVector.end(); )
+  {
+    auto innerLoopBound = findRange(it, localVector.end(), *it, pidCmp);
+    uint64_t offset = innerLoopBound.first - localVector.begin();
+    uint64_t size = innerLoopBound.second - innerLoopBound.first;
 
-    for(auto it2 = innerLoopBound.first; it2 != innerLoopBound.second; it2++)
+    if(size >= batchReadBudget)
     {
-      std::string seqHeader = ">" + std::to_string(std::get<readTuple::rid>(*it2)); 
-      std::string seqString;
-      getUnPackedRead<ReadInf>(std::get<readTuple::seq>(*it2), std::get<readTuple::cnt>(*it2), seqString);
+      //Partition runs alone, batch can't grow over it
+      if(batch.second > 0)
+        tasks.push_back(batch);
 
-      ofs << seqHeader << "\n" << seqString << "\n"; 
-      countReadsShared++;
+      tasks.emplace_back(offset, size);
+      batch = task_t(offset + size, 0);
     }
+    else
+    {
+      if(batch.second == 0)
+        batch.first = offset;
 
-#if DEBUGLOG
-    std::cerr << "Rank " << std::to_string(rank) << " shared " << std::to_string(countReadsShared) << " reads with rank " + std::to_string(rankToWhom) + "\n";
-#endif
+      batch.second += size;
+      if(batch.second >= batchReadBudget)
+      {
+        tasks.push_back(batch);
+        batch = task_t(offset + size, 0);
+      }
+    }
 
-    ofs.close();
+    it = innerLoopBound.second;
   }
 
-  //All boundary partitions should be ready in the file system before moving ahead
-  MP_TIMER_END_SECTION("[ASSEMBLY TIMER] Boundary partitions ready on disk");
+  if(batch.second > 0)
+    tasks.push_back(batch);
+
+  //Largest first, so that big partitions don't start last
+  std::stable_sort(tasks.begin(), tasks.end(),
+      [](const task_t& x, const task_t& y){
+      return x.second > y.second;});
+
+  uint64_t localTaskCount = tasks.size();
+  auto allTaskCounts = mxx::allgather(localTaskCount, comm);
+
+  //Expose the counter, descriptors and reads
+  MPI_Win counterWin, taskWin, readWin;
+  uint64_t* taskCounter;
+  MPI_Win_allocate(sizeof(uint64_t), sizeof(uint64_t), MPI_INFO_NULL, comm, &taskCounter, &counterWin);
+
+  //Local store into the window needs an epoch, under the separate memory model as well
+  MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, counterWin);
+  *taskCounter = 0;
+  MPI_Win_unlock(rank, counterWin);
+  MPI_Win_create(tasks.data(), tasks.size() * sizeof(task_t), sizeof(task_t), MPI_INFO_NULL, comm, &taskWin);
+  MPI_Win_create(localVector.data(), localVector.size() * sizeof(Q), 1, MPI_INFO_NULL, comm, &readWin);
+
+  //Counters should be initialized before anyone claims a task
   MPI_Barrier(comm);
+  MPI_Win_lock_all(0, counterWin);
+  MPI_Win_lock_all(0, taskWin);
+  MPI_Win_lock_all(0, readWin);
 
-  //Log count of times assember is used by this rank
-  int noTimesVelvetRun = 0;
+  //Reads of a task claimed from another rank
+  std::vector<Q> stolenReads;
 
-  for(auto it=localVector.begin(); it!=localVector.end(); )
-  {
-    auto innerLoopBound = findRange(it, localVector.end(), *it, pidCmp);
-    ofs.open(R.filename_fasta,std::ofstream::out);
+  int tasksDone = 0;
+  const uint64_t one = 1;
 
-    bool runVelvet = false;
+  for(int i = 0; i < p; i++)
+  {
+    int victim = (rank + i) % p;
 
-    //If this is first partition
-    if(innerLoopBound.first == localVector.begin())
+    while(true)
     {
-      //Don't check the partition size here, because we are also getting reads from other ranks
-      if(iDontOwnPartitionFirstPartition == false)
+      //Claim a task only when it can start right away. While waiting for a slot, keep calling MPI,
+      //since without asynchronous progress the RMA of other ranks on this rank's windows waits for it
+      while(pool.idleSlots() == 0)
       {
-        for(auto it2 = innerLoopBound.first; it2 != innerLoopBound.second; it2++)
+        pool.poll();
+        if(pool.idleSlots() > 0)
+          break;
+
+        int flag;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, MPI_STATUS_IGNORE);
+        usleep(1000);
+      }
+      int slot = pool.acquireSlot();
+
+      uint64_t taskIndex;
+      MPI_Fetch_and_op(&one, &taskIndex, MPI_UINT64_T, victim, 0, MPI_SUM, counterWin);
+      MPI_Win_flush(victim, counterWin);
+
+      //All tasks of this rank are claimed
+      if(taskIndex >= allTaskCounts[victim])
+      {
+        pool.release(slot);
+        break;
+      }
+
+      task_t task;
+      if(victim == rank)
+        task = tasks[taskIndex];
+      else
+      {
+        MPI_Get(&task, sizeof(task_t), MPI_BYTE, victim, taskIndex, sizeof(task_t), MPI_BYTE, taskWin);
+        MPI_Win_flush(victim, taskWin);
+      }
+
+      std::ofstream ofs;
+      ofs.open(pool.prepareInput(slot, estimateFastaBytes(task.second)), std::ofstream::out);
+
+      std::vector<PidType> pids;
+      if(victim == rank)
+      {
+        auto first = localVector.begin() + task.first;
+        appendReadsToFasta<ReadInf>(first, first + task.second, ofs);
+        pids = partitionIdsInRange(first, first + task.second);
+      }
+      else
+      {
+        stolenReads.resize(task.second);
+
+        //Fetch in chunks to keep the byte counts within int range
+        const uint64_t maxChunk = std::numeric_limits<int>::max() / sizeof(Q);
+        for(uint64_t j = 0; j < task.second; j += maxChunk)
         {
-          std::string seqHeader = ">" + std::to_string(std::get<readTuple::rid>(*it2)); 
-          std::string seqString;
-          getUnPackedRead<ReadInf>(std::get<readTuple::seq>(*it2), std::get<readTuple::cnt>(*it2), seqString);
-          ofs << seqHeader << "\n" << seqString << "\n"; 
+          int chunk = std::min(maxChunk, task.second - j) * sizeof(Q);
+          MPI_Get(&stolenReads[j], chunk, MPI_BYTE, victim, (task.first + j) * sizeof(Q), chunk, MPI_BYTE, readWin);
         }
+        MPI_Win_flush(victim, readWin);
 
-        //Get reads from other ranks
-        i = std::system(R.catBoundaryFiles(rank).c_str());
-        runVelvet = true;
+        appendReadsToFasta<ReadInf>(stolenReads.begin(), stolenReads.end(), ofs);
+        pids = partitionIdsInRange(stolenReads.begin(), stolenReads.end());
       }
+
+      ofs.close();
+      pool.launch(slot, pids);
+      tasksDone++;
     }
-    else if(innerLoopBound.second == localVector.end())
+  }
+
+  std::vector<Q>().swap(stolenReads);
+
+  MPI_Win_unlock_all(readWin);
+  MPI_Win_unlock_all(taskWin);
+  MPI_Win_unlock_all(counterWin);
+
+  //Collective, so reads stay exposed until every rank is done
+  MPI_Win_free(&readWin);
+  MPI_Win_free(&taskWin);
+  MPI_Win_free(&counterWin);
+
+  return tasksDone;
+}
+
+/*
+ * @brief                   Merges the contig files of all the ranks into a single output file using MPI-IO
+ * @param[in] localFiles    Pairs of <contig file, byte count>, only the first byte count bytes of a file are merged
+ * @details
+ *            1.  Every rank loads its contigs and renames them as >contig_<id> followed by the original header,
+ *                ids are unique across the ranks and increase with the rank
+ *            2.  Exclusive prefix sums over the contig and byte counts give every rank its first id and file offset
+ *            3.  All the ranks write their contigs at their offsets together with MPI_File_write_at_all
+ *            Contigs are a small fraction of the reads, so holding a rank's contigs in memory is fine
+ */
+inline void mergeContigFiles(const std::vector<std::pair<std::string, uint64_t>>& localFiles, const std::string& outputFile,
+                             MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  std::string contigs;
+  for(auto& file : localFiles)
+  {
+    std::ifstream ifs(file.first, std::ios_base::binary | std::ios_base::ate);
+    if(ifs.good())
+    {
+      std::size_t pos = contigs.size();
+      contigs.resize(pos + std::min<uint64_t>(ifs.tellg(), file.second));
+      ifs.seekg(0);
+      ifs.read(&contigs[pos], contigs.size() - pos);
+    }
+  }
+
+  uint64_t localContigCount = 0;
+  for(std::size_t i = 0; i < contigs.size(); i++)
+    if(contigs[i] == '>' && (i == 0 || contigs[i - 1] == '\n'))
+      localContigCount++;
+
+  //Id of this rank's first contig
+  uint64_t contigId = 0;
+  MPI_Exscan(&localContigCount, &contigId, 1, MPI_UINT64_T, MPI_SUM, comm);
+  if(!rank) contigId = 0;
+
+  //Rewrite the headers, rest of the lines are copied as is
+  std::string output;
+  output.reserve(contigs.size() + localContigCount * 24);
+  for(std::size_t i = 0; i < contigs.size();)
+  {
+    std::size_t lineEnd = contigs.find('\n', i);
+    lineEnd = (lineEnd == std::string::npos) ? contigs.size() : lineEnd + 1;
+
+    if(contigs[i] == '>')
+    {
+      output += ">contig_" + std::to_string(contigId++) + " ";
+      output.append(contigs, i + 1, lineEnd - i - 1);
+    }
+    else
+      output.append(contigs, i, lineEnd - i);
+
+    i = lineEnd;
+  }
+  std::string().swap(contigs);
+
+  uint64_t localBytes = output.size(), offset = 0, totalBytes = 0;
+  MPI_Exscan(&localBytes, &offset, 1, MPI_UINT64_T, MPI_SUM, comm);
+  if(!rank) offset = 0;
+  MPI_Allreduce(&localBytes, &totalBytes, 1, MPI_UINT64_T, MPI_SUM, comm);
+
+  MPI_File fh;
+  MPI_File_open(comm, outputFile.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+  MPI_File_set_size(fh, totalBytes);
+  writeAtAllInRounds(fh, offset, output.data(), localBytes, comm);
+  MPI_File_close(&fh);
+}
+
+//Merges the whole contig file of every rank
+inline void mergeContigFiles(const std::string& localFile, const std::string& outputFile, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  mergeContigFiles({std::make_pair(localFile, std::numeric_limits<uint64_t>::max())}, outputFile, comm);
+}
+
+/*
+ * @brief     Parallel assembly of read sequences with pids, fed with one or more batches of complete partitions
+ * @details
+ *            1. assemble() takes a batch sorted by pid, resolves its boundary partitions and queues it
+ *            2. Queued partitions are dumped into fasta files and assembled through AssemblerPool, which appends
+ *               the contigs to a file local to this processor. poll() does this while the pool has idle slots,
+ *               so that assembly of a batch overlaps with the work the caller does next
+ *            3. finish() assembles the rest and merges all the contig files, see mergeContigFiles()
+ *            With a ledger, contigs go to the ledger's contig file and finished partitions are recorded there,
+ *            finish() then merges the valid contigs of the earlier runs as well
+ */
+template <typename ReadInf, typename Q>
+class ParallelAssembly
+{
+  private:
+
+    typedef typename std::vector<Q>::iterator Iter;
+
+    //Reads of a batch, partitions in range [next, last) are yet to be assembled
+    struct PendingBatch
+    {
+      std::vector<Q> reads;
+      std::size_t next, last;
+    };
+
+    int rank, p;
+    cmdLineParams& cmdLineVals;
+    MPI_Comm comm;
+    AssemblyCommands R;
+
+    //Contigs of this rank are appended here
+    AssemblyLedger* ledger;
+    std::string contigFile;
+
+    //Assembler jobs of this rank run concurrently
+    AssemblerPool pool;
+
+    //Tiny partitions are assembled without velvet
+    MiniAssembler<ReadInf> mini;
+
+    uint64_t batchReadBudget;
+    AssemblyBatch<ReadInf, Iter> smallPartitions;
+    std::deque<PendingBatch> pending;
+
+    //Log count of times assember is used by this rank
+    int noTimesVelvetRun;
+
+    static int commRank(MPI_Comm c) { int r; MPI_Comm_rank(c, &r); return r; }
+    static int commSize(MPI_Comm c) { int s; MPI_Comm_size(c, &s); return s; }
+
+    //Assembles the next partition of the oldest pending batch
+    void assembleNextPartition()
     {
-      if(iShouldTransferLastPartition == false && innerLoopBound.second - innerLoopBound.first >= MIN_READ_COUNT_FOR_ASSEMBLY)
-      {  
-        for(auto it2 = innerLoopBound.first; it2 != innerLoopBound.second; it2++)
+      //Comparator for computing a partition's range
+      static layer_comparator<readTuple::pid, Q> pidCmp;
+
+      PendingBatch& batch = pending.front();
+      Iter it = batch.reads.begin() + batch.next;
+      Iter end = batch.reads.begin() + batch.last;
+
+      if(it != end)
+      {
+        auto innerLoopBound = findRange(it, end, *it, pidCmp);
+
+        if(innerLoopBound.second - innerLoopBound.first >= MIN_READ_COUNT_FOR_ASSEMBLY)
         {
-          std::string seqHeader = ">" + std::to_string(std::get<readTuple::rid>(*it2)); 
-          std::string seqString;
-          getUnPackedRead<ReadInf>(std::get<readTuple::seq>(*it2), std::get<readTuple::cnt>(*it2), seqString);
-          ofs << seqHeader << "\n" << seqString << "\n"; 
+          if(mini.accepts(innerLoopBound.second - innerLoopBound.first))
+            mini.assemble(innerLoopBound.first, innerLoopBound.second);
+          else
+            noTimesVelvetRun += smallPartitions.add(innerLoopBound.first, innerLoopBound.second);
         }
 
-        runVelvet = true;
+        batch.next = innerLoopBound.second - batch.reads.begin();
+      }
+
+      //Buffered ranges point into the batch, so launch them before it goes
+      if(batch.next == batch.last)
+      {
+        noTimesVelvetRun += smallPartitions.flush();
+        pending.pop_front();
       }
     }
-    else if(innerLoopBound.second - innerLoopBound.first >= MIN_READ_COUNT_FOR_ASSEMBLY)
+
+  public:
+
+    /*
+     * @param[in] ledger_     Records the finished partitions if not null, see AssemblyLedger
+     */
+    ParallelAssembly(cmdLineParams &cmdLineVals_, MPI_Comm comm_ = MPI_COMM_WORLD, AssemblyLedger* ledger_ = nullptr)
+      : rank(commRank(comm_)), p(commSize(comm_)), cmdLineVals(cmdLineVals_), comm(comm_),
+        R(rank, cmdLineVals),
+        ledger(ledger_), contigFile(ledger_ ? ledger_->contigFile() : R.filename_contigs),
+        pool(rank, cmdLineVals, contigFile, cmdLineVals.assemblerConcurrency, ledger),
+        mini(cmdLineVals.velvetKmerSize, MINI_ASSEMBLY_READ_THRESHOLD, contigFile, ledger),
+        //Partitions may share shorter kmers, batching is safe only if velvet uses KMER_LEN or longer kmers.
+        //Pieces of a split partition share the kmers removed between them, so they are never batched
+        batchReadBudget((cmdLineVals.velvetKmerSize >= KMER_LEN && !cmdLineVals.splitGiant) ? ASSEMBLY_BATCH_READ_BUDGET : 0),
+        smallPartitions(pool, batchReadBudget),
+        noTimesVelvetRun(0)
     {
-      for(auto it2 = innerLoopBound.first; it2 != innerLoopBound.second; it2++)
+      //Clean things in case output already exists
+      std::ofstream(contigFile, std::ofstream::out).close();
+      if(!rank) std::remove(R.outputContigFile.c_str());
+    }
+
+    /*
+     * @brief                     Takes a batch of reads for assembly, collective
+     * @param[in/out] localVector Reads of complete partitions, placed by placeReadsForAssembly(). Emptied
+     * @param[in] deferred        If true, the batch is only queued and assembled by poll() and finish().
+     *                            The dynamic schedule steals work only among batches that are not deferred
+     */
+    void assemble(std::vector<Q> &localVector, bool deferred = false)
+    {
+      //Timer to see balance of assembly load among the ranks
+      MP_TIMER_START();
+
+      //Assuming localVector was sorted by pids in the previous step
+
+      //The role of this function is trivial, except that there might be partitions spawning
+      //across multiple ranks. To deal with this, we will handle end boundary partitions as special case
+
+      //Comparator for computing a partition's range
+      static layer_comparator<readTuple::pid, Q> pidCmp;
+
+      /*
+       * NEED TO DO SOME WORK FOR RESOLVING BOUNDARY PARTITIONS
+       * 1. Partition that spans over more than 1 rank, we will assume the highest rank owns it
+       * 2. Let other ranks who don't own a partition stream the reads to the owner, see sendBoundaryPartition()
+       * 3. Rank which owns the partition would receive the reads into its own read fasta file
+       */
+
+      //Only the contiguous schedule splits partitions across ranks
+      bool partitionsSpanRanks = (cmdLineVals.assemblySchedule == "contiguous");
+
+      bool iShouldTransferLastPartition = false;
+      int rankToWhom = MAX_INT;
+      bool iDontOwnPartitionFirstPartition = false;
+
+      //Range of the partitions left for the pending queue
+      std::size_t first = 0, last = localVector.size();
+
+      if(partitionsSpanRanks)
       {
-        std::string seqHeader = ">" + std::to_string(std::get<readTuple::rid>(*it2)); 
-        std::string seqString;
-        getUnPackedRead<ReadInf>(std::get<readTuple::seq>(*it2), std::get<readTuple::cnt>(*it2), seqString);
-        ofs << seqHeader << "\n" << seqString << "\n"; 
+        //Ids and read counts for first and last partition this rank has
+        //Small batches may leave the highest ranks empty, these get ids after all the valid ones
+        std::vector<PidType> boundaryPartitionIds(2, std::numeric_limits<PidType>::max());
+        std::vector<uint64_t> boundaryPartitionSizes(2, 0);
+        if(!localVector.empty())
+        {
+          boundaryPartitionIds[0] = std::get<readTuple::pid>(localVector.front());
+          boundaryPartitionIds[1] = std::get<readTuple::pid>(localVector.back());
+          boundaryPartitionSizes[0] = findRange(localVector.begin(), localVector.end(), localVector.front(), pidCmp).second - localVector.begin();
+          boundaryPartitionSizes[1] = findRange(localVector.rbegin(), localVector.rend(), localVector.back(), pidCmp).second - localVector.rbegin();
+        }
+
+        auto allBoundaryPartitionIds = mxx::allgatherv(boundaryPartitionIds, comm);
+        auto allBoundaryPartitionSizes = mxx::allgatherv(boundaryPartitionSizes, comm);
+
+        //Total read count of the first partition of the owner rank, including the reads sent to it
+        auto sharedPartitionSize = [&](int owner) {
+          uint64_t size = allBoundaryPartitionSizes[2*owner];
+          for(int sender = 0; sender < owner; sender++)
+            if(allBoundaryPartitionIds[2*sender + 1] == allBoundaryPartitionIds[2*owner])
+              size += allBoundaryPartitionSizes[2*sender + 1];
+          return size;
+        };
+
+        //Decide if I owe someone else my last partition
+        //IF : My last partition's Id matches with first partition's id of rank one higher to me
+        if(!localVector.empty() && rank < p - 1 && (allBoundaryPartitionIds[2*rank + 1] == allBoundaryPartitionIds[2*(rank + 1)]) )
+        {
+          iShouldTransferLastPartition = true;
+
+          //Compute which rank to transfer 
+          auto partitionRange = std::equal_range(allBoundaryPartitionIds.begin(), allBoundaryPartitionIds.end(), allBoundaryPartitionIds[2*rank + 1]);
+          auto indexFromStartLastOccurence = std::distance(allBoundaryPartitionIds.begin(), partitionRange.second) - 1; 
+          rankToWhom = ((int)indexFromStartLastOccurence)/2;
+        }
+
+        //See if I own my first partition or not
+        //IF :  I have only 1 partition with me and it needs to be transferred to higher rank
+        if(allBoundaryPartitionIds[2*rank] == allBoundaryPartitionIds[2*rank + 1] && iShouldTransferLastPartition) 
+          iDontOwnPartitionFirstPartition = true;
+
+        //Send last partition to its owner, unless the partition is too small to assemble
+        //Owners receive when they assemble their first partition. Owner is always a higher rank,
+        //so the chain of ranks waiting on each other ends at the highest rank and can't deadlock
+        if(iShouldTransferLastPartition)
+        {
+          if(sharedPartitionSize(rankToWhom) >= MIN_READ_COUNT_FOR_ASSEMBLY)
+            sendBoundaryPartition(localVector.end() - boundaryPartitionSizes[1], localVector.end(), rankToWhom, comm);
+          last = localVector.size() - boundaryPartitionSizes[1];
+
+#if DEBUGLOG
+          std::cerr << "Rank " << std::to_string(rank) << " shared " << std::to_string(boundaryPartitionSizes[1]) << " reads with rank " + std::to_string(rankToWhom) + "\n";
+#endif
+        }
+
+        //See if lower ranks send me reads of my first partition, they are the ranks just below me
+        bool iReceiveFirstPartition = rank > 0 && !localVector.empty() && iDontOwnPartitionFirstPartition == false
+          && allBoundaryPartitionIds[2*(rank - 1) + 1] == allBoundaryPartitionIds[2*rank];
+
+        if(iReceiveFirstPartition && sharedPartitionSize(rank) >= MIN_READ_COUNT_FOR_ASSEMBLY)
+        {
+          int slot = pool.acquireSlot();
+          std::ofstream ofs(pool.prepareInput(slot, estimateFastaBytes(sharedPartitionSize(rank))),std::ofstream::out);
+          appendReadsToFasta<ReadInf>(localVector.begin(), localVector.begin() + boundaryPartitionSizes[0], ofs);
+
+          //Get reads from other ranks, which are the lower ranks ending with the same partition
+          for(int sender = 0; sender < rank; sender++)
+            if(allBoundaryPartitionIds[2*sender + 1] == allBoundaryPartitionIds[2*rank])
+              receiveBoundaryPartition<ReadInf, Q>(sender, ofs, comm);
+          ofs.close();
+
+          pool.launch(slot, std::vector<PidType>(1, allBoundaryPartitionIds[2*rank]));
+          noTimesVelvetRun++;
+        }
+
+        //Shared first partition is either assembled above or sent away
+        if(iReceiveFirstPartition || iDontOwnPartitionFirstPartition)
+          first = std::min(last, (std::size_t)boundaryPartitionSizes[0]);
       }
-      runVelvet = true;
-    }
 
-    ofs.close();
+      MP_TIMER_END_SECTION("[ASSEMBLY TIMER] Boundary partitions resolved");
 
-    if(runVelvet)
+      //Nothing to steal with a single rank
+      if(cmdLineVals.assemblySchedule == "dynamic" && p > 1 && !deferred)
+      {
+        noTimesVelvetRun += assembleWithWorkStealing<ReadInf>(localVector, pool, batchReadBudget, mini, comm);
+        std::vector<Q>().swap(localVector);
+      }
+      else
+      {
+        pending.push_back(PendingBatch());
+        pending.back().reads.swap(localVector);
+        pending.back().next = first;
+        pending.back().last = last;
+
+        if(deferred)
+          poll();
+        else
+        {
+          while(!pending.empty())
+            assembleNextPartition();
+        }
+      }
+    }
+
+    /*
+     * @brief     Assembles queued partitions as long as the pool has idle slots, doesn't wait for the jobs
+     * @details   Partitions taken by the mini assembler run right here
+     */
+    void poll()
     {
-      i = std::system(R.velvetExe1.c_str());
-      i = std::system(R.velvetExe2.c_str());
-      i = std::system(R.backupContigs.c_str());
-      i = std::system(R.resetVelvet.c_str());
-      i = std::system(R.resetInput.c_str());
+      pool.poll();
 
-      noTimesVelvetRun++;
+      while(!pending.empty() && pool.idleSlots() > 0)
+        assembleNextPartition();
     }
 
-    //Increment the loop variable
-    it = innerLoopBound.second;
-  }
+    //Assembles everything queued, waits for the jobs and merges the contigs of all the ranks, collective
+    void finish()
+    {
+      MP_TIMER_START();
+
+      while(!pending.empty())
+        assembleNextPartition();
+
+      pool.waitAll();
+      mini.flush();
 
 #if DEBUGLOG
-  std::cerr << "Rank " << rank << " ran assembler " << noTimesVelvetRun << " times\n";
+      std::cerr << "Rank " << rank << " ran assembler " << noTimesVelvetRun << " times\n";
 #endif
 
-  MP_TIMER_END_SECTION("[ASSEMBLY TIMER] Parallel assembly completed");
-  MPI_Barrier(comm);
-  for(int I = 0; I < p; I++)
-  {
-    if(I == rank)
-    {
+      MP_TIMER_END_SECTION("[ASSEMBLY TIMER] Parallel assembly completed");
+
 #if DEBUGLOG
-      std::cerr << "Rank " << rank << " finished assembly.";
-      i = std::system(("du -sh " + R.filename_contigs + " 1>&2").c_str()); 
+      struct stat st;
+      stat(contigFile.c_str(), &st);
+      std::cerr << "Rank " << rank << " finished assembly with " << st.st_size << " bytes of contigs\n";
 #endif
-      i = std::system(R.finalMerge.c_str());
-    }
-    MPI_Barrier(comm);
-  }
 
+      //Concatenate all the contigs to a single file, all ranks together
+      std::vector<std::pair<std::string, uint64_t>> localFiles;
+      if(ledger)
+        localFiles = ledger->previousContigs();
+      localFiles.emplace_back(contigFile, std::numeric_limits<uint64_t>::max());
+
+      mergeContigFiles(localFiles, R.outputContigFile, comm);
 
-  //Delete shared folder to keep next run correct
-  //Important otherwise files may corrupt future runs
-  if(!rank) i = std::system(R.resetSharedFolder.c_str());
+      MP_TIMER_END_SECTION("[ASSEMBLY TIMER] Contigs merged");
+    }
+};
 
-  //No-op
-  i = i;
+/*
+ * @brief     With read sequences and pids in the vector (sorted by pid), run parallel assembly using a assembler
+ * @details   Assembles a single batch, see ParallelAssembly
+ */
+template <typename ReadInf, typename Q>
+void runParallelAssembly(std::vector<Q> &localVector, cmdLineParams &cmdLineVals, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  ParallelAssembly<ReadInf, Q> assembly(cmdLineVals, comm);
+  assembly.assemble(localVector);
+  assembly.finish();
 }
 
+/*
+ * @brief     Post processing and assembly of the partitions, fed with batches of read tags
+ * @details   Every batch should hold the read tags of complete partitions. Partitions finished early
+ *            during partitioning can be handed over in batches with handOff(deferred = true), so that
+ *            their assembly overlaps with the remaining iterations. Call poll() once in a while then.
+ *            The partition store is closed with the last batch, before its assembly starts, so that
+ *            an interrupted assembly can be resumed from the store, see resumeAssemblyFromStore()
+ */
+template <typename KmerType>
+class AssemblyPipeline
+{
+  private:
+
+    //Determining storage container for read sequences
+    typedef readStorageInfo<typename KmerType::KmerAlphabet, typename KmerType::KmerWordType> ReadSeqTypeInfo; 
+
+    //Type of array to hold read sequence
+    typedef std::array<typename ReadSeqTypeInfo::ReadWordType, ReadSeqTypeInfo::nWords> ReadSeqType;
+
+    //tuple of type <Sequence, ReadId, PartitionId, Size of read> 
+    //This order is defined in configParam.hpp as <seq,rid,pid,cnt>
+    typedef std::tuple<ReadSeqType, ReadIdType, PidType, uint32_t> tuple_t;
+
+    //tuple of type <ReadId, PartitionId>
+    //This order is defined in configParam.hpp as <rid,pid>
+    typedef std::tuple<ReadIdType, PidType> readPid_t;
+
+    std::vector<bool>& readFilterFlags;
+    std::vector<ReadLenType>& readTrimLengths;
+    std::vector<ReadIdType> readIdOffsets;
+    cmdLineParams &cmdLineVals;
+    MPI_Comm comm;
+
+    //Finished partitions are recorded if asked for, for resuming
+    std::unique_ptr<AssemblyLedger> ledger;
+
+    //Assembly is left out if the assembler is turned off
+    std::unique_ptr< ParallelAssembly<ReadSeqTypeInfo, tuple_t> > assembly;
+
+    //Partitioned reads are saved for later if asked for
+    std::unique_ptr< PartitionStoreWriter<ReadSeqTypeInfo> > store;
+
+    //Statistics of the partitions of all the batches, for the histogram
+    std::vector<partitionStat_t> allStats;
+
+    int batchCount;
+
+  public:
+
+    /*
+     * @param[in] localReadCount    Count of reads this rank parses from the input file
+     */
+    AssemblyPipeline(std::vector<bool>& readFilterFlags_, std::vector<ReadLenType>& readTrimLengths_,
+                     ReadIdType localReadCount, cmdLineParams &cmdLineVals_, MPI_Comm comm_ = MPI_COMM_WORLD)
+      : readFilterFlags(readFilterFlags_), readTrimLengths(readTrimLengths_),
+        readIdOffsets(getReadIdOffsets(localReadCount, comm_)), cmdLineVals(cmdLineVals_),
+        comm(comm_), batchCount(0)
+    {
+      if(cmdLineVals.runAssembler && !cmdLineVals.ledgerDir.empty())
+        ledger.reset(new AssemblyLedger(cmdLineVals.ledgerDir, false, comm));
+
+      if(cmdLineVals.runAssembler)
+        assembly.reset(new ParallelAssembly<ReadSeqTypeInfo, tuple_t>(cmdLineVals, comm, ledger.get()));
+
+      if(!cmdLineVals.partitionStorePrefix.empty())
+        store.reset(new PartitionStoreWriter<ReadSeqTypeInfo>(cmdLineVals.partitionStorePrefix,
+              cmdLineVals.splitGiant ? PARTITION_STORE_SPLIT_PIECES : 0, comm));
+    }
+
+    /*
+     * @brief                         Maps the reads of a batch to their partitions and assembles them, collective
+     * @param[in/out] readTagVector   Read tags of complete partitions, emptied
+     * @param[in] deferred            If true, assembly of the batch overlaps with the caller's work.
+     *                                Otherwise the batch is the last one
+     */
+    template <typename T>
+    void handOff(std::vector<T>& readTagVector, bool deferred = false)
+    {
+      batchCount++;
+
+      //New vector type needs to be defined to hold read sequences
+      std::vector<tuple_t> newlocalVector;
+
+      //Vector with readId and partitionIds
+      std::vector<readPid_t> readPidVector;
+
+      //Get the readPidVector populated with readId and partitionIds
+      MP_TIMER_START();
+      generateReadToPartitionMapping(readTagVector, readPidVector);
+      std::vector<T>().swap(readTagVector);
+
+      //Shuffle the pids before reads are sorted by them
+      shufflePids(readPidVector);
+      MP_TIMER_END_SECTION("[POSTPROCESS TIMER] ReadId-Pid mapping completed");
+
+      //Partitions too small to assemble only count in the histogram
+      removeTinyPartitions(readPidVector, allStats, comm);
+      MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Tiny partitions removed");
+
+      //Get the newlocalVector poulated with vector of read strings and partition ids
+      MP_MEMORY_TRACK("Read sequences", newlocalVector);
+      MP_MEMORY_PROJECT("Read sequences of the partitions", readPidVector.size() * sizeof(tuple_t));
+      generateSequencesVector<KmerType>(cmdLineVals, readIdOffsets, readPidVector, newlocalVector, readFilterFlags, readTrimLengths);
+      MP_TIMER_END_SECTION("[POSTPROCESS TIMER] ReadStrings-Pid mapping completed");
+
+      //Read and kmer counts of the partitions
+      std::vector<partitionStat_t> statsVector = computePartitionStats(newlocalVector, comm);
+      MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Partition statistics computed");
+
+      //Move reads to the ranks which assemble their partitions
+      placeReadsForAssembly(newlocalVector, statsVector, cmdLineVals, comm);
+      allStats.insert(allStats.end(), statsVector.begin(), statsVector.end());
+      MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Reads placed for assembly using " + cmdLineVals.assemblySchedule + " schedule");
+
+      if(store)
+      {
+        store->write(newlocalVector);
+        MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Batch " + std::to_string(batchCount) + " written to partition store");
+
+        if(!deferred)
+        {
+          store->close();
+          store.reset();
+          MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Partition store index written");
+        }
+      }
+
+      if(assembly)
+      {
+        assembly->assemble(newlocalVector, deferred);
+        MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Batch " + std::to_string(batchCount) + " handed over to assembly");
+      }
+    }
+
+    //Keeps the assembly of earlier batches going, not collective
+    void poll()
+    {
+      if(assembly)
+        assembly->poll();
+    }
+
+    //Writes the read histogram, finishes assembly and merges the contigs, collective
+    void finish()
+    {
+      int rank;
+      MPI_Comm_rank(comm, &rank);
+
+      MP_TIMER_START();
+
+      //Logging the histogram of partition size in terms of reads
+      std::string histFileName = "partitionRead.hist";
+      std::string summaryFileName = "partitionRead.summary";
+      if(!rank) std::cout << "Generating read histogram in file " << histFileName << " and summary in file " << summaryFileName << "\n";
+      generateHistogramFromPartitionStats<partitionStatTuple::reads>(allStats, histFileName, summaryFileName, comm);
+      std::vector<partitionStat_t>().swap(allStats);
+      MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Read sized partition histogram generated");
+
+      //Still open if the last batch was deferred
+      if(store)
+      {
+        store->close();
+        store.reset();
+        MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Partition store index written");
+      }
+
+      if(assembly)
+      {
+        assembly->finish();
+        MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Parallel assembly completed");
+      }
+    }
+};
+
 //Wrapper for all the post processing functions
+//Accepts the read tags separated from the kmer tuples after partitioning
+//localReadCount is the count of reads this rank parses from the input file
 template <typename KmerType,  typename T>
-void finalPostProcessing(std::vector<T>& localVector, 
+void finalPostProcessing(std::vector<T>& readTagVector, 
                         std::vector<bool>& readFilterFlags, 
                         std::vector<ReadLenType>& readTrimLengths,
+                        ReadIdType localReadCount,
                         cmdLineParams &cmdLineVals,
                         MPI_Comm comm = MPI_COMM_WORLD)
 {
-  int rank;
-  MPI_Comm_rank(comm, &rank);
+  AssemblyPipeline<KmerType> pipeline(readFilterFlags, readTrimLengths, localReadCount, cmdLineVals, comm);
+  pipeline.handOff(readTagVector);
+  pipeline.finish();
+}
 
-  //Determining storage container for read sequences
+/*
+ * @brief     Assembles the partitions of a partition store which the ledger doesn't list as finished, collective
+ * @details
+ *            1.  Every rank opens the store and the ledger, both should be visible to all the ranks
+ *            2.  Rank pid % p loads the reads of its unfinished partitions from the store
+ *            3.  Reads are placed with the lpt schedule and assembled, see ParallelAssembly. Contigs of the
+ *                earlier runs are merged along with the new ones, so contigs.fa is complete in the end
+ *            The store should be written by an earlier run with the same build, see AssemblyPipeline
+ */
+template <typename KmerType>
+void resumeAssemblyFromStore(cmdLineParams &cmdLineVals, MPI_Comm comm = MPI_COMM_WORLD)
+{
   typedef readStorageInfo<typename KmerType::KmerAlphabet, typename KmerType::KmerWordType> ReadSeqTypeInfo; 
-
-  //Type of array to hold read sequence
   typedef std::array<typename ReadSeqTypeInfo::ReadWordType, ReadSeqTypeInfo::nWords> ReadSeqType;
-
-  //tuple of type <Sequence, ReadId, PartitionId, Size of read> 
-  //This order is defined in configParam.hpp as <seq,rid,pid,cnt>
   typedef std::tuple<ReadSeqType, ReadIdType, PidType, uint32_t> tuple_t;
 
-  //New vector type needs to be defined to hold read sequences
-  std::vector<tuple_t> newlocalVector;
+  int rank, p;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &p);
 
-  //Get the newlocalVector populated with readId and partitionIds
   MP_TIMER_START();
-  generateReadToPartitionMapping<KmerType>(cmdLineVals, localVector, newlocalVector, readFilterFlags, readTrimLengths);
-  MP_TIMER_END_SECTION("[POSTPROCESS TIMER] ReadId-Pid mapping completed");
 
-  //Get the newlocalVector poulated with vector of read strings and partition ids
-  generateSequencesVector<KmerType>(cmdLineVals, newlocalVector, readFilterFlags, readTrimLengths);
-  MP_TIMER_END_SECTION("[POSTPROCESS TIMER] ReadStrings-Pid mapping completed");
+  AssemblyLedger ledger(cmdLineVals.ledgerDir, true, comm);
 
-  //Logging the histogram of partition size in terms of reads
-  std::string histFileName = "partitionRead.hist";
-  if(!rank) std::cout << "Generating read histogram in file " << histFileName << "\n";
-  generatePartitionSizeHistogram<readTuple::pid>(newlocalVector, histFileName);
-  MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Read sized partition histogram generated");
+  PartitionStoreReader store;
+  std::string error;
+  if(!store.open(cmdLineVals.partitionStorePrefix, error))
+  {
+    std::cerr << "Rank " << rank << " : " << error << "\n";
+    MPI_Abort(comm, 1);
+  }
 
-  shuffleAndResortPids(newlocalVector);
-  MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Partition ids shuffled");
+  const PartitionStoreHeader& info = store.info();
 
-  //Run parallel assembly
-  runParallelAssembly<ReadSeqTypeInfo>(newlocalVector, cmdLineVals);
-  MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Parallel assembly completed");
+  //Pieces of a split partition should not be batched, see ParallelAssembly
+  if(info.flags & PARTITION_STORE_SPLIT_PIECES)
+    cmdLineVals.splitGiant = true;
 
+  if(info.bitsPerChar != ReadSeqTypeInfo::bitsPerChar || info.nWords != ReadSeqTypeInfo::nWords
+      || info.wordBytes != sizeof(typename ReadSeqTypeInfo::ReadWordType))
+  {
+    if(!rank) std::cerr << "Read storage of the partition store does not match this build, MAX_READ_SIZE should be " << info.maxReadSize << "\n";
+    MPI_Abort(comm, 1);
+  }
+
+  //Load the reads of the unfinished partitions owned by this rank, extents are sorted by pid
+  std::vector<tuple_t> localVector;
+  std::vector<partitionStat_t> statsVector;
+  uint64_t localPartitions = 0;
+
+  for(std::size_t i = 0; i < store.extentCount(); i++)
+  {
+    auto extent = store.extent(i);
+    if(extent.pid % p != (uint64_t)rank)
+      continue;
+
+    //Ids are 64 bit in the store, a 32 bit build can't take ids written by a 64 bit build
+    if(extent.pid > std::numeric_limits<PidType>::max())
+    {
+      std::cerr << "Rank " << rank << " : partition ids of the store need a build with METAG_64BIT_IDS\n";
+      MPI_Abort(comm, 1);
+    }
+
+    bool firstExtent = (i == 0 || store.extent(i - 1).pid != extent.pid);
+    if(firstExtent)
+      localPartitions++;
+
+    if(ledger.completed(extent.pid))
+      continue;
+
+    const char* record = store.records(extent);
+    if(record == nullptr)
+    {
+      std::cerr << "Rank " << rank << " : reads of partition " << extent.pid << " can not be read from "
+        << partitionStoreReadsFile(cmdLineVals.partitionStorePrefix, extent.file) << "\n";
+      MPI_Abort(comm, 1);
+    }
+
+    for(uint64_t r = 0; r < extent.reads; r++, record += store.recordBytes())
+    {
+      uint64_t rid;
+      uint32_t length;
+      std::memcpy(&rid, record, sizeof(rid));
+      std::memcpy(&length, record + sizeof(rid), sizeof(length));
+
+      if(length > ReadSeqTypeInfo::maxCharCount)
+      {
+        std::cerr << "Rank " << rank << " : read " << rid << " of partition " << extent.pid << " is corrupt in "
+          << partitionStoreReadsFile(cmdLineVals.partitionStorePrefix, extent.file) << "\n";
+        MPI_Abort(comm, 1);
+      }
+
+      localVector.emplace_back();
+      std::memcpy(std::get<readTuple::seq>(localVector.back()).data(), record + PARTITION_RECORD_PREFIX_BYTES, sizeof(ReadSeqType));
+      std::get<readTuple::rid>(localVector.back()) = rid;
+      std::get<readTuple::pid>(localVector.back()) = extent.pid;
+      std::get<readTuple::cnt>(localVector.back()) = length;
+    }
+
+    if(firstExtent)
+      statsVector.emplace_back(extent.pid, 0, 0);
+    std::get<partitionStatTuple::reads>(statsVector.back()) += extent.reads;
+    std::get<partitionStatTuple::kmers>(statsVector.back()) += extent.kmers;
+  }
+
+  uint64_t totalPartitions = mxx::allreduce(localPartitions, comm);
+  uint64_t remainingPartitions = mxx::allreduce((uint64_t)statsVector.size(), comm);
+  if(!rank) std::cout << "Resuming assembly of " << remainingPartitions << " of " << totalPartitions << " partitions\n";
+  MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Unfinished partitions loaded from the partition store");
+
+  //Partitions are never split across ranks here
+  PartitionSchedule schedule = computeAssemblySchedule(statsVector, comm);
+  sendReadsToPartitionOwners(localVector, schedule, comm);
+  MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Reads placed for assembly");
+
+  ParallelAssembly<ReadSeqTypeInfo, tuple_t> assembly(cmdLineVals, comm, &ledger);
+  assembly.assemble(localVector);
+  assembly.finish();
+  MP_TIMER_END_SECTION("[POSTPROCESS TIMER] Parallel assembly completed");
 }
 
 #endif
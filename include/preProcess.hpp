@@ -177,7 +177,7 @@ void computeKmerFrequencyAbsolute(std::vector<T>& localvector, MPI_Comm comm = M
  */
 template <unsigned int tmpLayer, unsigned int readIdLayer, unsigned int kmerSnoLayer, bool filterbyMedian, bool filterbyMax, typename T>
 void updateReadFilterFlags(std::vector<T>& localvector, std::vector<bool>& readFilterFlags, std::vector<ReadLenType>& readTrimLengths,
-                          uint32_t firstReadId, 
+                          ReadIdType firstReadId, 
                           MPI_Comm comm = MPI_COMM_WORLD)
 {
   //Know my rank
@@ -0,0 +1,249 @@
+#ifndef SECTION_TRACE_HPP
+#define SECTION_TRACE_HPP
+
+//Includes
+#include <mpi.h>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Includes from mxx library
+#include <mxx/collective.hpp>
+#include <mxx/timer.hpp>
+
+//Own includes
+#include "memoryUsage.hpp"
+#include "commStats.hpp"
+
+/*
+ * @brief     Per rank timeline of the timed sections, written as a single Chrome trace (JSON) file for
+ *            chrome://tracing or Perfetto
+ * @details   Recording is off until enable() is called, then every section of MP_TIMER_END_SECTION, every
+ *            MP_TRACE_SCOPE and MP_TRACE_COLLECTIVE adds a complete event on the track of its rank.
+ *            Timed sections end in a collective reduction, its wait is recorded as a separate collective event,
+ *            so a straggler shows up as long waits on all the other ranks. If the memory report is on (see
+ *            memoryUsage.hpp), the resident set size and peak of every section are added as counters.
+ *            Sections split the communication counts as well in builds with METAG_COMM_STATS (see commStats.hpp).
+ *            Timestamps are taken from MPI_Wtime() relative to a barrier at enable()
+ */
+class SectionTrace
+{
+  private:
+
+    struct Event
+    {
+      std::string name;
+      const char* category;
+      double begin, end;
+      int iteration;
+    };
+
+    bool enabled;
+    int rank;
+    double origin;
+
+    //Resident set size and peak in bytes at the end of a section
+    struct Counter
+    {
+      double time;
+      uint64_t rss, peak;
+    };
+
+    //Iteration of the partitioning loop the events belong to, -1 outside the loop
+    int currentIteration;
+
+    std::vector<Event> events;
+    std::vector<Counter> counters;
+
+    SectionTrace() : enabled(false), rank(0), origin(0), currentIteration(-1) {}
+
+    static void appendEscaped(std::string& out, const std::string& s)
+    {
+      for(char c : s)
+      {
+        if(c == '"' || c == '\\')
+          out += '\\';
+        if((unsigned char)c >= 0x20)
+          out += c;
+      }
+    }
+
+  public:
+
+    static SectionTrace& get()
+    {
+      static SectionTrace trace;
+      return trace;
+    }
+
+    //Starts recording, collective
+    void enable(MPI_Comm comm = MPI_COMM_WORLD)
+    {
+      MPI_Comm_rank(comm, &rank);
+      MPI_Barrier(comm);
+      origin = MPI_Wtime();
+      enabled = true;
+    }
+
+    bool on() const
+    {
+      return enabled;
+    }
+
+    //Microseconds since enable()
+    double now() const
+    {
+      return (MPI_Wtime() - origin) * 1e6;
+    }
+
+    void setIteration(int iteration)
+    {
+      currentIteration = iteration;
+    }
+
+    void record(const std::string& name, const char* category, double begin, double end)
+    {
+      if(enabled)
+        events.push_back(Event{name, category, begin, end, currentIteration});
+    }
+
+    void recordMemory(double time, uint64_t rss, uint64_t peak)
+    {
+      if(enabled)
+        counters.push_back(Counter{time, rss, peak});
+    }
+
+    /*
+     * @brief     Gathers the events of all the ranks and writes them to filename on root, collective
+     * @details   Ranks are listed as processes named "rank <r>"
+     */
+    void write(const std::string& filename, MPI_Comm comm = MPI_COMM_WORLD)
+    {
+      std::string json;
+      char buffer[128];
+
+      //Parts of the ranks are concatenated on root, every part holds the metadata at least
+      if(rank)
+        json += ",\n";
+      std::snprintf(buffer, sizeof(buffer), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"rank %d\"}},\n", rank, rank);
+      json += buffer;
+      std::snprintf(buffer, sizeof(buffer), "{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"sort_index\":%d}}", rank, rank);
+      json += buffer;
+
+      for(auto it = events.begin(); it != events.end(); it++)
+      {
+        json += ",\n{\"name\":\"";
+        appendEscaped(json, it->name);
+        std::snprintf(buffer, sizeof(buffer), "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":0",
+            it->category, it->begin, it->end - it->begin, rank);
+        json += buffer;
+
+        if(it->iteration >= 0)
+        {
+          std::snprintf(buffer, sizeof(buffer), ",\"args\":{\"iteration\":%d}", it->iteration);
+          json += buffer;
+        }
+        json += "}";
+      }
+
+      for(auto it = counters.begin(); it != counters.end(); it++)
+      {
+        std::snprintf(buffer, sizeof(buffer), ",\n{\"name\":\"Memory (MB)\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"args\":{\"rss\":%.1f,\"peak\":%.1f}}",
+            it->time, rank, it->rss / double(1 << 20), it->peak / double(1 << 20));
+        json += buffer;
+      }
+
+      std::vector<char> localJson(json.begin(), json.end());
+      std::string().swap(json);
+      auto globalJson = mxx::gather_vectors(localJson, comm);
+
+      if(!rank)
+      {
+        std::ofstream ofs(filename, std::ios_base::out);
+        ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        ofs.write(globalJson.data(), globalJson.size());
+        ofs << "\n]}\n";
+
+        std::cout << "Trace written to " << filename << "\n";
+      }
+
+      events.clear();
+      counters.clear();
+    }
+};
+
+/*
+ * @brief     Same as mxx::section_timer, also records its sections in the SectionTrace and reports
+ *            their memory usage when the MemoryUsage report is on
+ */
+class tracedSectionTimer
+{
+  private:
+    mxx::section_timer timer;
+    double last;
+
+  public:
+    tracedSectionTimer() : last(SectionTrace::get().now()) {}
+
+    void end_section(const std::string& name)
+    {
+      SectionTrace& trace = SectionTrace::get();
+      double entry = trace.now();
+
+#ifdef METAG_COMM_STATS
+      //Communication of the timer and the memory report is not counted
+      CommStats::get().endSection(name);
+      commCountingPaused() = true;
+#endif
+
+      //Reduces the section times across the ranks
+      timer.end_section(name);
+
+      if(trace.on())
+      {
+        trace.record(name, "section", last, entry);
+        trace.record(name + " [wait]", "collective", entry, trace.now());
+      }
+
+      if(MemoryUsage::get().on())
+      {
+        uint64_t rss, peak;
+        MemoryUsage::get().endSection(name, rss, peak);
+        trace.recordMemory(entry, rss, peak);
+      }
+
+#ifdef METAG_COMM_STATS
+      commCountingPaused() = false;
+#endif
+      last = trace.now();
+    }
+};
+
+/*
+ * @brief     Records the lifetime of the object as an event in the SectionTrace
+ */
+class traceScope
+{
+  private:
+    std::string name;
+    const char* category;
+    double begin;
+
+  public:
+    traceScope(const std::string& name_, const char* category_ = "scope")
+      : category(category_), begin(SectionTrace::get().now())
+    {
+      if(SectionTrace::get().on())
+        name = name_;
+    }
+
+    ~traceScope()
+    {
+      SectionTrace& trace = SectionTrace::get();
+      trace.record(name, category, begin, trace.now());
+    }
+};
+
+#endif
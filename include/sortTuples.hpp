@@ -8,6 +8,7 @@
 #include <mxx/sort.hpp>
 #include <mxx/shift.hpp>
 #include <mxx/timer.hpp>
+#include <mxx/distribution.hpp>
 
 //Own includes
 #include "prettyprint.hpp"
@@ -719,4 +720,107 @@ bool checkTermination(typename std::vector<T>::iterator start, typename std::vec
   return globalMinY == TMAX;
 }
 
+
+/*
+ * @brief                         Runs the partitioning iterations on kmer tuples (kmer, Pn, Pc) until every partition is inactive
+ * @details                       Each iteration sorts by kmer and reduces Pn, sorts by Pc and reduces Pc, then moves
+ *                                the inactive tuples behind the active ones and rebalances the active tuples.
+ *                                On return Pn equals Pc for every tuple, and Pc gives the component of the tuple
+ * @param[in] onIteration         Called as onIteration(localVector, activeCount, pendCount) after the tuples in
+ *                                [activeCount, pendCount) became inactive in this iteration. It may remove tuples of that
+ *                                range only, e.g. to pull out the read tags of the finished partitions, and may reorder
+ *                                the inactive tuples from activeCount on
+ * @return                        Count of iterations
+ */
+template <typename T, typename IterationCallback>
+int runPartitioningIterations(std::vector<T>& localVector, IterationCallback onIteration, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  // define k-mer and operator types
+  typedef KmerReduceAndMarkAsInactive<T> KmerReducerType;
+  typedef PartitionReduceAndMarkAsInactive<T> PartitionReducerType;
+  ActivePartitionPredicate<T> app;
+
+  auto start = localVector.begin();
+  auto end = localVector.end();
+  auto pend = end;
+
+  bool keepGoing = true;
+  int countIterations = 0;
+  while (keepGoing) {
+
+    // steps of every iteration are traced, see sectionTrace.hpp
+    MP_TRACE_ITERATION(countIterations);
+    MP_TRACE_SCOPE("Partitioning iteration");
+
+    // sort by k-mers and update Pn
+    {
+      MP_TRACE_COLLECTIVE("Sort by kmer");
+      mxx::sort(start, pend, layer_comparator<kmerTuple::kmer, T>(), comm, true);
+    }
+    {
+      MP_TRACE_SCOPE("Kmer reduce");
+      KmerReducerType r1;
+      r1(start, pend, comm);
+    }
+
+    // sort by P_c and update P_c via P_n
+    {
+      MP_TRACE_COLLECTIVE("Sort by Pc");
+      mxx::sort(start, pend, layer_comparator<kmerTuple::Pc, T>(), comm, true);
+    }
+    {
+      MP_TRACE_SCOPE("Partition reduce");
+      PartitionReducerType r2;
+      r2(start, pend, comm);
+    }
+
+    // check for global termination
+    {
+      MP_TRACE_COLLECTIVE("Termination check");
+      keepGoing = !checkTermination<kmerTuple::Pn, T>(start, pend, comm);
+    }
+
+    if (keepGoing) {
+      // now reduce to only working with active partitions
+      auto activeEnd = std::partition(start, pend, app);
+
+      // let the caller see the partitions finished in this iteration
+      std::size_t activeCount = activeEnd - localVector.begin();
+      {
+        MP_TRACE_SCOPE("Finished partitions handed to caller");
+        onIteration(localVector, activeCount, (std::size_t)(pend - localVector.begin()));
+      }
+      start = localVector.begin();
+      end = localVector.end();
+      activeEnd = start + activeCount;
+
+      pend = activeEnd;
+      // re-shuffle the partitions to counter-act the load-inbalance
+      MP_TRACE_COLLECTIVE("Active partitions rebalanced");
+      pend = mxx::block_decompose_partitions(start, pend, end, comm);
+    }
+
+    countIterations++;
+    if(!rank)
+      std::cout << "[RANK 0] : Iteration # " << countIterations <<"\n";
+  }
+  MP_TRACE_ITERATION(-1);
+
+  //Lets ensure Pn and Pc are equal for every tuple
+  //This was not ensured during the program run
+  std::for_each(localVector.begin(), localVector.end(), [](T &t){ std::get<kmerTuple::Pn>(t) = std::get<kmerTuple::Pc>(t);});
+
+  return countIterations;
+}
+
+//Same as above, without looking at the finished partitions during the iterations
+template <typename T>
+int runPartitioningIterations(std::vector<T>& localVector, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  return runPartitioningIterations(localVector, [](std::vector<T>&, std::size_t, std::size_t){}, comm);
+}
+
 #endif
@@ -0,0 +1,324 @@
+#ifndef SPLIT_GIANT_COMPONENT_HPP
+#define SPLIT_GIANT_COMPONENT_HPP
+
+//Includes
+#include <mpi.h>
+#include <unordered_map>
+
+//Includes from mxx library
+#include <mxx/sort.hpp>
+#include <mxx/collective.hpp>
+#include <mxx/distribution.hpp>
+
+//Own includes
+#include "sortTuples.hpp"
+#include "configParam.hpp"
+#include "parallel_fastq_iterate.hpp"
+#include "postProcess.hpp"
+
+//tuple of type <KmerId, P_new, P_old, ReadId>
+//Same as the partitioning tuples, with the read id of the kmer kept aside for re-running the iterations
+typedef std::tuple<KmerIdType, PidType, PidType, ReadIdType> giantTuple_t;
+
+/*
+ * @brief                       Counts the reads of every partition using the read tags
+ * @param[in] readTagVector     Read tags (READ_TAG | readId, Pn, Pc) or giant tuples, in any order
+ * @return                      Pairs of <PartitionId, Count of reads> of the partitions owned by this rank,
+ *                              i.e. the ones with pid % p == rank, sorted by pid
+ */
+template <typename T>
+std::vector<std::pair<PidType, uint64_t>> countReadsPerComponent(const std::vector<T>& readTagVector, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int p;
+  MPI_Comm_size(comm, &p);
+
+  //Partial counts of the partitions that have read tags on this rank
+  std::unordered_map<PidType, uint64_t> localCounts;
+  for(auto it = readTagVector.begin(); it != readTagVector.end(); it++)
+    if(std::get<kmerTuple::kmer>(*it) & READ_TAG)
+      localCounts[std::get<kmerTuple::Pc>(*it)]++;
+
+  //Pairs of <PartitionId, Count of reads>
+  std::vector<std::pair<PidType, uint64_t>> countVector(localCounts.begin(), localCounts.end());
+  std::unordered_map<PidType, uint64_t>().swap(localCounts);
+
+  //Send partial counts to rank pid % p
+  std::sort(countVector.begin(), countVector.end(),
+      [p](const std::pair<PidType, uint64_t>& x, const std::pair<PidType, uint64_t>& y){
+      return std::make_pair(x.first % p, x.first) < std::make_pair(y.first % p, y.first);});
+
+  std::vector<int> sendCounts(p, 0);
+  for(auto it = countVector.begin(); it != countVector.end(); it++)
+    sendCounts[it->first % p]++;
+
+  mxx::all2all(countVector, sendCounts, comm).swap(countVector);
+  std::sort(countVector.begin(), countVector.end());
+
+  //Sum up the partial counts of a partition
+  auto countEnd = countVector.begin();
+  for(auto it = countVector.begin(); it != countVector.end();)
+  {
+    auto innerLoopBound = std::equal_range(it, countVector.end(), *it,
+        [](const std::pair<PidType, uint64_t>& x, const std::pair<PidType, uint64_t>& y){
+        return x.first < y.first;});
+
+    uint64_t readCount = 0;
+    for(auto it2 = innerLoopBound.first; it2 != innerLoopBound.second; it2++)
+      readCount += it2->second;
+
+    *countEnd++ = std::make_pair(it->first, readCount);
+    it = innerLoopBound.second;
+  }
+  countVector.erase(countEnd, countVector.end());
+
+  return countVector;
+}
+
+/*
+ * @brief                       Finds the largest partition using the read tags
+ * @param[in] readTagVector     Read tags (READ_TAG | readId, Pn, Pc) or giant tuples, in any order
+ * @return                      Pair of <Count of reads, PartitionId> of the largest partition, same on all ranks.
+ *                              Ties are broken by the smaller pid
+ */
+template <typename T>
+std::pair<uint64_t, PidType> findLargestComponent(const std::vector<T>& readTagVector, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  auto countVector = countReadsPerComponent(readTagVector, comm);
+
+  std::pair<uint64_t, PidType> localLargest(0, std::numeric_limits<PidType>::max());
+  for(auto it = countVector.begin(); it != countVector.end(); it++)
+    if(it->second > localLargest.first || (it->second == localLargest.first && it->first < localLargest.second))
+      localLargest = std::make_pair(it->second, it->first);
+
+  auto allLargest = mxx::allgather(localLargest, comm);
+  return *std::min_element(allLargest.begin(), allLargest.end(),
+      [](const std::pair<uint64_t, PidType>& x, const std::pair<uint64_t, PidType>& y){
+      return x.first > y.first || (x.first == y.first && x.second < y.second);});
+}
+
+/*
+ * @brief                       Computes the degree of every kmer in the read-kmer graph, i.e. count of its tuples
+ * @details                     Tuples are sorted by kmer globally, and the degree is saved in the Pn layer.
+ *                              Buckets spanning over ranks are summed up using the gathered boundary buckets
+ * @return                      Maximum degree among the kmers which are not read tags
+ */
+template <typename T>
+PidType computeKmerDegree(std::vector<T>& localVector, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  static layer_comparator<kmerTuple::kmer, T> kmerCmp;
+
+  mxx::sort(localVector.begin(), localVector.end(), kmerCmp, comm, false);
+
+  //Pairs of <KmerId, Count> for the first and the last bucket of this rank
+  std::vector<std::pair<KmerIdType, uint64_t>> toSend;
+
+  for(auto it = localVector.begin(); it != localVector.end();)
+  {
+    auto innerLoopBound = findRange(it, localVector.end(), *it, kmerCmp);
+    PidType currentCount = innerLoopBound.second - innerLoopBound.first;
+
+    std::for_each(innerLoopBound.first, innerLoopBound.second, [currentCount](T &t){ std::get<kmerTuple::Pn>(t) = currentCount;});
+
+    if(innerLoopBound.first == localVector.begin() || innerLoopBound.second == localVector.end())
+      toSend.emplace_back(std::get<kmerTuple::kmer>(*it), currentCount);
+
+    it = innerLoopBound.second;
+  }
+
+  auto allBoundaryKmers = mxx::allgatherv(toSend, comm);
+
+  //Update the buckets at both ends with their global size
+  for(auto it = toSend.begin(); it != toSend.end(); it++)
+  {
+    PidType globalCount = 0;
+    for(auto it2 = allBoundaryKmers.begin(); it2 != allBoundaryKmers.end(); it2++)
+      if(it2->first == it->first)
+        globalCount += it2->second;
+
+    T key = T();
+    std::get<kmerTuple::kmer>(key) = it->first;
+    auto innerLoopBound = std::equal_range(localVector.begin(), localVector.end(), key, kmerCmp);
+    std::for_each(innerLoopBound.first, innerLoopBound.second, [globalCount](T &t){ std::get<kmerTuple::Pn>(t) = globalCount;});
+  }
+
+  PidType localMaxDegree = 0;
+  for(auto it = localVector.begin(); it != localVector.end(); it++)
+    if(!(std::get<kmerTuple::kmer>(*it) & READ_TAG))
+      localMaxDegree = std::max(localMaxDegree, std::get<kmerTuple::Pn>(*it));
+
+  PidType maxDegree;
+  mxx::datatype<PidType> dt;
+  MPI_Allreduce(&localMaxDegree, &maxDegree, 1, dt.type(), MPI_MAX, comm);
+
+  return maxDegree;
+}
+
+//Appends the read tags among the giant tuples in [first, last) to readTagVector
+template <typename Iter, typename T>
+void moveReadTags(Iter first, Iter last, std::vector<T>& readTagVector)
+{
+  for(auto it = first; it != last; it++)
+  {
+    if(std::get<kmerTuple::kmer>(*it) & READ_TAG)
+    {
+      T tagToInsert;
+      std::get<kmerTuple::kmer>(tagToInsert) = std::get<kmerTuple::kmer>(*it);
+      std::get<kmerTuple::Pn>(tagToInsert) = std::get<kmerTuple::Pc>(*it);
+      std::get<kmerTuple::Pc>(tagToInsert) = std::get<kmerTuple::Pc>(*it);
+      readTagVector.push_back(tagToInsert);
+    }
+  }
+}
+
+/*
+ * @brief     Splits the largest partition by removing its high degree kmers, i.e. knots of the de Bruijn graph
+ * @details
+ *            1.  Find the largest partition, nothing is done unless it holds GIANT_COMPONENT_READ_FRACTION of the reads
+ *            2.  Parse the kmers of its reads again, and re-initialize Pn and Pc with the read ids
+ *            3.  In each round, compute the degree of the kmers, i.e. count of reads they occur in, remove the ones with
+ *                degree >= cutoff and re-run the partitioning iterations on the remaining tuples.
+ *                The cutoff starts at half the maximum degree and halves every round, down to GIANT_KMER_MIN_DEGREE
+ *            4.  Pieces other than the largest one are final, the next round works on the tuples of the largest piece only.
+ *                Rounds stop once the largest piece holds at most GIANT_SPLIT_TARGET_FRACTION of the reads
+ *            Degree is the proxy for betweenness here, kmers shared by many reads are the ones most paths in the
+ *            read-kmer graph go through. Reads of a piece are assembled in full, but a read whose kmers were all
+ *            removed becomes a piece of its own, and pieces with fewer than MIN_READ_COUNT_FOR_ASSEMBLY reads are
+ *            dropped before assembly like any tiny partition. Rank 0 reports the reads lost this way.
+ *            Pieces get the smallest read id in them as pid, the read ids of a partition are not used by any other
+ *            partition, so the new pids are unique
+ * @param[in/out] readTagVector   Read tags (READ_TAG | readId, Pn, Pc) after partitioning,
+ *                                read tags of the largest partition are replaced by the ones of its pieces
+ * @param[in] localReadCount      Count of reads parsed by this rank, as returned by readFASTQFile()
+ */
+template <typename KmerType, typename T>
+void splitGiantComponent(std::vector<T>& readTagVector,
+                         std::vector<bool>& readFilterFlags, std::vector<ReadLenType>& readTrimLengths,
+                         ReadIdType localReadCount, cmdLineParams &cmdLineVals, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  uint64_t totalReadCount = mxx::allreduce((uint64_t)readTagVector.size(), comm);
+  auto giant = findLargestComponent(readTagVector, comm);
+
+  if(!rank)
+    std::cout << "Largest partition holds " << giant.first << " of " << totalReadCount << " reads\n";
+
+  if(giant.first == 0 || giant.first < GIANT_COMPONENT_READ_FRACTION * totalReadCount)
+    return;
+
+  //Move the read tags of the giant out, and bring its read ids to the ranks which parse them
+  PidType giantPid = giant.second;
+  auto giantStart = std::partition(readTagVector.begin(), readTagVector.end(),
+      [giantPid](const T &t){ return std::get<kmerTuple::Pc>(t) != giantPid;});
+
+  typedef typename std::tuple<ReadIdType, PidType> tuple_t2;
+  std::vector<tuple_t2> readPidVector;
+  for(auto it = giantStart; it != readTagVector.end(); it++)
+    readPidVector.emplace_back(std::get<kmerTuple::kmer>(*it) & ~READ_TAG, giantPid);
+  readTagVector.erase(giantStart, readTagVector.end());
+
+  std::vector<ReadIdType> readIdOffsets = getReadIdOffsets(localReadCount, comm);
+  sendReadPidsToReadOwners(readPidVector, readIdOffsets, comm);
+
+  //Filter settings which skip the reads outside the giant
+  std::vector<bool> parseFilterFlags(readFilterFlags.size(), false);
+  std::vector<ReadLenType> parseTrimLengths(readTrimLengths.size(), 0);
+  for(auto it = readPidVector.begin(); it != readPidVector.end(); it++)
+  {
+    auto localReadId = std::get<readPidTuple::rid>(*it) - readIdOffsets[rank];
+    parseFilterFlags[localReadId] = readFilterFlags[localReadId];
+    parseTrimLengths[localReadId] = readTrimLengths[localReadId];
+  }
+  std::vector<tuple_t2>().swap(readPidVector);
+
+  //Same kmers and read tags as during partitioning, read ids are saved aside and Pc is the giant's pid
+  std::vector<giantTuple_t> giantVector;
+  readFASTQFile< KmerType, includeAllKmersAndReadTagsinFilteredReads<KmerType> > (cmdLineVals, giantVector, parseFilterFlags, parseTrimLengths, comm);
+  std::for_each(giantVector.begin(), giantVector.end(), [giantPid](giantTuple_t &t){ 
+      std::get<3>(t) = std::get<kmerTuple::Pn>(t);
+      std::get<kmerTuple::Pc>(t) = giantPid;});
+
+  std::vector<bool>().swap(parseFilterFlags);
+  std::vector<ReadLenType>().swap(parseTrimLengths);
+
+  //Read tags of the pieces, counted before they join the other read tags
+  std::vector<T> pieceTags;
+
+  PidType cutoff = 0;
+  uint64_t largestPieceReads = giant.first;
+  for(int round = 1; round <= GIANT_SPLIT_MAX_ROUNDS; round++)
+  {
+    mxx::block_decompose(giantVector, comm);
+
+    PidType maxDegree = computeKmerDegree(giantVector, comm);
+    cutoff = std::max((PidType)GIANT_KMER_MIN_DEGREE, (round == 1 ? maxDegree : cutoff) / 2);
+
+    //No knots left to remove
+    if(maxDegree < cutoff)
+    {
+      if(!rank)
+        std::cout << "Giant split round " << round << " : maximum kmer degree " << maxDegree << " is below " << cutoff << "\n";
+      break;
+    }
+
+    //Remove the knots and start over with read ids as partition ids
+    auto knotStart = std::partition(giantVector.begin(), giantVector.end(),
+        [cutoff](const giantTuple_t &t){
+        return (std::get<kmerTuple::kmer>(t) & READ_TAG) || std::get<kmerTuple::Pn>(t) < cutoff;});
+    uint64_t removedCount = mxx::allreduce((uint64_t)(giantVector.end() - knotStart), comm);
+    giantVector.erase(knotStart, giantVector.end());
+
+    std::for_each(giantVector.begin(), giantVector.end(), [](giantTuple_t &t){
+        std::get<kmerTuple::Pn>(t) = std::get<kmerTuple::Pc>(t) = std::get<3>(t);});
+
+    mxx::block_decompose(giantVector, comm);
+    runPartitioningIterations(giantVector, comm);
+
+    auto largestPiece = findLargestComponent(giantVector, comm);
+    largestPieceReads = largestPiece.first;
+
+    if(!rank)
+      std::cout << "Giant split round " << round << " : removed " << removedCount << " kmer tuples with degree >= " << cutoff
+        << ", largest piece holds " << largestPieceReads << " reads\n";
+
+    //Stop once the largest piece is small enough
+    if(largestPieceReads <= GIANT_SPLIT_TARGET_FRACTION * totalReadCount)
+      break;
+
+    //Read tags of the other pieces go back, only the largest piece goes to the next round
+    PidType largestPid = largestPiece.second;
+    auto pieceStart = std::partition(giantVector.begin(), giantVector.end(),
+        [largestPid](const giantTuple_t &t){ return std::get<kmerTuple::Pc>(t) == largestPid;});
+    moveReadTags(pieceStart, giantVector.end(), pieceTags);
+    giantVector.erase(pieceStart, giantVector.end());
+  }
+
+  //Read tags of the remaining tuples keep their current partition
+  moveReadTags(giantVector.begin(), giantVector.end(), pieceTags);
+  std::vector<giantTuple_t>().swap(giantVector);
+
+  //Pieces too small to assemble, single reads without kmers among them, are dropped by removeTinyPartitions()
+  uint64_t localTinyPieces = 0, localTinyPieceReads = 0;
+  for(auto& piece : countReadsPerComponent(pieceTags, comm))
+    if(piece.second < MIN_READ_COUNT_FOR_ASSEMBLY)
+    {
+      localTinyPieces++;
+      localTinyPieceReads += piece.second;
+    }
+  uint64_t tinyPieces = mxx::allreduce(localTinyPieces, comm);
+  uint64_t tinyPieceReads = mxx::allreduce(localTinyPieceReads, comm);
+
+  readTagVector.insert(readTagVector.end(), pieceTags.begin(), pieceTags.end());
+  std::vector<T>().swap(pieceTags);
+
+  if(!rank)
+  {
+    std::cout << "Largest partition of " << giant.first << " reads split, largest piece holds " << largestPieceReads
+      << " reads (" << 100.0 * largestPieceReads / totalReadCount << "% of all reads)\n";
+    std::cout << tinyPieceReads << " reads of the largest partition are left out of assembly, they are in "
+      << tinyPieces << " pieces with fewer than " << MIN_READ_COUNT_FOR_ASSEMBLY << " reads\n";
+  }
+}
+
+#endif
@@ -1,169 +1,109 @@
-#ifndef METAG_UTILS_HPP 
-#define METAG_UTILS_HPP 
+#ifndef METAG_UTILS_HPP
+#define METAG_UTILS_HPP
 
 //Includes
 #include <mpi.h>
 
 //Includes from mxx library
-#include <mxx/sort.hpp>
+#include <mxx/collective.hpp>
 
 //Own includes
 #include "sortTuples.hpp"
+#include "partitionSchedule.hpp"
 #include "prettyprint.hpp"
 
+#include <array>
 #include <fstream>
 #include <iostream>
+#include <unordered_map>
 
 
-//Helper function for generating histogram
-//Inserts the given value to the map
-template <typename T, typename T2>
-void insertToHistogram(T& hist, T2 value)
-{
-  //Check if it doesn't exist in the map
-  if(hist.end() == hist.find(value))
-    hist[value] = 1;
-  else
-    hist[value]++;
-}
-
 /**
- * @brief Generates a histogram to see partition size v/s count information
- * @tparam keyLayer   Should denote the partition_Id layer
- * @param start,end   Indicate the start and end iterator for local vector of 
- *                    tuples
- * @NOTE              Returns histogram on root only
+ * @brief Counts the tuples of every partition in statLayer of partial statistics, without sorting the data
+ * @tparam keyLayer     Should denote the partition_Id layer of the tuples
+ * @tparam statLayer    Layer of partitionStat_t to count the tuples in, the other counts are left zero
+ * @param[out] partialStats   Partial counts of the partitions with tuples on this rank are appended,
+ *                            see mergePartitionStats()
+ * @NOTE              Consecutive tuples of a partition cost a single hash lookup, so input sorted
+ *                    by keyLayer is counted in one scan with a lookup per partition
  */
-template <uint8_t keyLayer , typename T>
-void generatePartitionSizeHistogram(typename std::vector<T>& localVector, std::string filename, MPI_Comm comm = MPI_COMM_WORLD)
+template <uint8_t keyLayer, uint8_t statLayer, typename T>
+void countTuplesPerPartition(const typename std::vector<T>& localVector, std::vector<partitionStat_t>& partialStats)
 {
-  /*
-   * Approach :
-   * 1. Do a global sort by keyLayer (Partition id).
-   * 2. Compute the information Partition_Id:Size for boundary partitions (Avoid duplication).
-   * 3. Do an all_gather of boundary values plugged with ranks.
-   * 4. All boundary partitions should be owned by minimum rank that shares it.
-   * 5. Locally compute the largest partition size and do MPI_Allreduce 
-   *    with MPI_MAX.
-   * 6. Build the histogram locally. 
-   * 7. Finally do MPI_Reduce over whole histogram to root node.
-   * 8. Write the output to file
-   */
-
-  int p;
-  int rank;
-  MPI_Comm_size(comm, &p);
-  MPI_Comm_rank(comm, &rank);
+  std::unordered_map<PidType, uint64_t> localCounts;
 
-  static layer_comparator<keyLayer, T> pccomp;
-
-  //Sort the vector by each tuple's keyLayer element
-  mxx::sort(localVector.begin(), localVector.end(), pccomp, comm, false);
-
-  //Iterate over tuples to compute boundary information
-  
-  bool iownLeftBucket, iownRightBucket, onlySingleLocalPartition;
-  //Type of tuple to communicate : (Partition Id, rank, size)
-  typedef std::tuple<uint32_t, int, uint64_t> tupletypeforbucketSize;
-  std::vector<tupletypeforbucketSize> toSend;
-  toSend.resize(2);
-
-  //Find the left most bucket
-  auto leftBucketRange = findRange(localVector.begin(), localVector.end(), *(localVector.begin()), pccomp);
-  std::get<0>(toSend[0]) = std::get<keyLayer>(*localVector.begin()); 
-  std::get<1>(toSend[0]) = rank;
-  std::get<2>(toSend[0]) = leftBucketRange.second - leftBucketRange.first;
-
-  //Find the right most bucket
-  auto rightBucketRange = findRange(localVector.rbegin(), localVector.rend(), *(localVector.rbegin()), pccomp);
-  std::get<0>(toSend[1]) = std::get<keyLayer>(*localVector.rbegin()); 
-  std::get<1>(toSend[1]) = rank;
-  std::get<2>(toSend[1]) = rightBucketRange.second - rightBucketRange.first;
-
-  //If we have only single partition, make sure we are not creating duplicates
-  if(std::get<0>(toSend[0]) == std::get<0>(toSend[1]))
+  for(auto it = localVector.begin(); it != localVector.end();)
   {
-    //Make second send element's size zero
-    std::get<2>(toSend[1]) = 0;
-    onlySingleLocalPartition = true;
-  }
-  else
-    onlySingleLocalPartition = false;
+    auto runEnd = it + 1;
+    while(runEnd != localVector.end() && std::get<keyLayer>(*runEnd) == std::get<keyLayer>(*it))
+      runEnd++;
 
-  //Gather all the boundary information
-  auto allBoundaryPartitionSizes = mxx::allgather_vectors(toSend, comm);
-
-  uint64_t leftBucketSize = 0;
-  uint64_t rightBucketSize = 0;
-
-  //Need to parse boundary information that matches the partitionIds we have
-  static layer_comparator<0, tupletypeforbucketSize> pccomp2;
-  auto leftBucketBoundaryRange = std::equal_range(allBoundaryPartitionSizes.begin(), allBoundaryPartitionSizes.end(), toSend[0], pccomp2);
-
-  //Check if this processor owns this bucket
-  if(std::get<1>(*(leftBucketBoundaryRange.first)) == rank)
-  {
-    iownLeftBucket = true;
-    for(auto it = leftBucketBoundaryRange.first; it != leftBucketBoundaryRange.second; it++)
-    {
-      leftBucketSize += std::get<2>(*it);
-    }
+    localCounts[std::get<keyLayer>(*it)] += runEnd - it;
+    it = runEnd;
   }
-  else
-    iownLeftBucket = false;
-
-  auto rightBucketBoundaryRange = std::equal_range(allBoundaryPartitionSizes.begin(), allBoundaryPartitionSizes.end(), toSend[1], pccomp2);
 
-  //Check if this processor owns right partition
-  if(std::get<1>(*rightBucketBoundaryRange.first) == rank && !onlySingleLocalPartition)
+  partialStats.reserve(partialStats.size() + localCounts.size());
+  for(auto it = localCounts.begin(); it != localCounts.end(); it++)
   {
-    iownRightBucket = true;
-    for(auto it = rightBucketBoundaryRange.first; it != rightBucketBoundaryRange.second; it++)
-    {
-      rightBucketSize += std::get<2>(*it);
-    }
+    partitionStat_t stat(it->first, 0, 0);
+    std::get<statLayer>(stat) = it->second;
+    partialStats.push_back(stat);
   }
-  else
-    iownRightBucket = false;
+}
 
-  //Map from partition size to count 
-  typedef std::map <uint64_t, uint32_t> MapType;
-  MapType localHistMap;
+//Count of log2 bins in the partition summary, bin 0 holds the size 0 and bin b > 0 the sizes in [2^(b-1), 2^b)
+const int PARTITION_SUMMARY_BINS = 65;
 
-  for(auto it = localVector.begin(); it!= localVector.end();)  // iterate over all segments.
-  {
-    auto innerLoopBound = findRange(it, localVector.end(), *it, pccomp);
+inline int partitionSizeBin(uint64_t size)
+{
+  int b = 0;
+  for(; size > 0; size >>= 1)
+    b++;
+  return b;
+}
 
-    //Left most bucket
-    if (innerLoopBound.first == localVector.begin()) // first
-    {
-      if(iownLeftBucket)
-        insertToHistogram(localHistMap, leftBucketSize);
-    }
-    //Right most bucket
-    else if (innerLoopBound.second == localVector.end()) // first
-    {
-      if(iownRightBucket)
-        insertToHistogram(localHistMap, rightBucketSize);
-    }
-    //Inner buckets
-    else
-    {
-      insertToHistogram(localHistMap, innerLoopBound.second - innerLoopBound.first);
-    }
+/**
+ * @brief Generates a histogram of partition sizes from per partition statistics
+ * @tparam sizeLayer  Should denote the layer with partition size
+ * @param statsVector Every partition should be listed by exactly one rank,
+ *                    e.g. output of computePartitionStats()
+ * @param summaryFilename   If not empty, a summary is written to this file as well : log2 binned histogram of
+ *                          the sizes, the PARTITION_SUMMARY_TOP_COUNT largest partitions and the kmers per read
+ *                          of every bin and partition
+ * @NOTE              Output format is same as generatePartitionSizeHistogram(),
+ *                    but no sort of the partitioned data is needed.
+ *                    Histogram and summary are computed in a single scan over the statistics
+ */
+template <uint8_t sizeLayer , typename T>
+void generateHistogramFromPartitionStats(const typename std::vector<T>& statsVector, std::string filename,
+                                         std::string summaryFilename = "", MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank;
+  MPI_Comm_rank(comm, &rank);
 
-    it = innerLoopBound.second;
-  }
+  //Map from partition size to count
+  std::unordered_map<uint64_t, uint64_t> localHistMap;
 
-  //Convert map to vector
-  using tupleTypeforHist = std::tuple<uint64_t, uint32_t>;
-  std::vector<tupleTypeforHist> localHistVector;
+  //Per bin : count of partitions, reads and kmers
+  std::array<uint64_t, 3 * PARTITION_SUMMARY_BINS> bins;
+  bins.fill(0);
 
-  for(MapType::iterator it = localHistMap.begin(); it != localHistMap.end(); ++it ) 
+  for(auto it = statsVector.begin(); it != statsVector.end(); it++)
   {
-    localHistVector.push_back(std::make_tuple(it->first, it->second));
+    uint64_t size = std::get<sizeLayer>(*it);
+    localHistMap[size]++;
+
+    int b = partitionSizeBin(size);
+    bins[3 * b]++;
+    bins[3 * b + 1] += std::get<partitionStatTuple::reads>(*it);
+    bins[3 * b + 2] += std::get<partitionStatTuple::kmers>(*it);
   }
 
+  //Convert map to vector
+  using tupleTypeforHist = std::tuple<uint64_t, uint64_t>;
+  std::vector<tupleTypeforHist> localHistVector(localHistMap.begin(), localHistMap.end());
+  std::unordered_map<uint64_t, uint64_t>().swap(localHistMap);
+
   //Gather vector from all processors to root
   auto globalHistVector = mxx::gather_vectors(localHistVector, comm);
   static layer_comparator<0, tupleTypeforHist> partition_size_cmp;
@@ -171,21 +111,18 @@ void generatePartitionSizeHistogram(typename std::vector<T>& localVector, std::s
   //Write to file
   if(rank == 0)
   {
-    //Sort the vector to bring counts with same size adjacent (default comparator will work)
     std::sort(globalHistVector.begin(), globalHistVector.end());
 
     std::ofstream ofs;
     ofs.open(filename, std::ios_base::out);
 
-    //Iterate over the global vector
     for(auto it = globalHistVector.begin(); it != globalHistVector.end();)
     {
       //Range of counts belonging to same partition size
       auto innerLoopRange = findRange(it, globalHistVector.end(), *it, partition_size_cmp);
       auto p_size = std::get<0>(*it);
-      uint32_t sum = 0;
+      uint64_t sum = 0;
 
-      //Loop over the range
       for(auto it2 = innerLoopRange.first; it2 != innerLoopRange.second; it2++)
         sum += std::get<1>(*it2);
 
@@ -194,10 +131,87 @@ void generatePartitionSizeHistogram(typename std::vector<T>& localVector, std::s
     }
 
     ofs.close();
+  }
+
+  if(summaryFilename.empty())
+    return;
+
+  //Largest first, ties broken by pid so that the output doesn't depend on the rank count
+  auto largerFirst = [](const T& x, const T& y) {
+    return std::make_pair(std::get<sizeLayer>(x), std::get<partitionStatTuple::pid>(y))
+         > std::make_pair(std::get<sizeLayer>(y), std::get<partitionStatTuple::pid>(x));};
+
+  //Local candidates for the largest partitions
+  std::size_t topCount = std::min<std::size_t>(PARTITION_SUMMARY_TOP_COUNT, statsVector.size());
+  std::vector<T> largest(topCount);
+  std::partial_sort_copy(statsVector.begin(), statsVector.end(), largest.begin(), largest.end(), largerFirst);
+
+  auto globalLargest = mxx::gather_vectors(largest, comm);
+
+  std::array<uint64_t, 3 * PARTITION_SUMMARY_BINS> globalBins;
+  MPI_Reduce(bins.data(), globalBins.data(), globalBins.size(), MPI_UINT64_T, MPI_SUM, 0, comm);
+
+  if(rank == 0)
+  {
+    topCount = std::min<std::size_t>(PARTITION_SUMMARY_TOP_COUNT, globalLargest.size());
+    std::partial_sort(globalLargest.begin(), globalLargest.begin() + topCount, globalLargest.end(), largerFirst);
+
+    auto kmersPerRead = [](uint64_t kmers, uint64_t reads) {
+      return (reads > 0) ? (double)kmers / reads : 0.0;};
+
+    uint64_t partitions = 0, reads = 0, kmers = 0;
+    for(int b = 0; b < PARTITION_SUMMARY_BINS; b++)
+    {
+      partitions += globalBins[3 * b];
+      reads += globalBins[3 * b + 1];
+      kmers += globalBins[3 * b + 2];
+    }
+
+    std::ofstream ofs;
+    ofs.open(summaryFilename, std::ios_base::out);
+
+    ofs << "#partitions reads kmers kmers_per_read\n";
+    ofs << partitions << " " << reads << " " << kmers << " " << kmersPerRead(kmers, reads) << "\n";
+
+    ofs << "#size_from size_to partitions reads kmers kmers_per_read\n";
+    for(int b = 0; b < PARTITION_SUMMARY_BINS; b++)
+    {
+      if(globalBins[3 * b] == 0)
+        continue;
+
+      uint64_t from = (b == 0) ? 0 : uint64_t(1) << (b - 1);
+      uint64_t to = (b == 0) ? 0 : from + (from - 1);
+      ofs << from << " " << to << " " << globalBins[3 * b] << " " << globalBins[3 * b + 1] << " "
+        << globalBins[3 * b + 2] << " " << kmersPerRead(globalBins[3 * b + 2], globalBins[3 * b + 1]) << "\n";
+    }
+
+    ofs << "#largest pid reads kmers kmers_per_read\n";
+    for(std::size_t i = 0; i < topCount; i++)
+    {
+      const T& stat = globalLargest[i];
+      ofs << std::get<partitionStatTuple::pid>(stat) << " " << std::get<partitionStatTuple::reads>(stat) << " "
+        << std::get<partitionStatTuple::kmers>(stat) << " "
+        << kmersPerRead(std::get<partitionStatTuple::kmers>(stat), std::get<partitionStatTuple::reads>(stat)) << "\n";
+    }
 
+    ofs.close();
   }
 }
 
+/**
+ * @brief Generates a histogram to see partition size v/s count information
+ * @tparam keyLayer   Should denote the partition_Id layer
+ * @NOTE              Partitions are counted by hashing their ids, see countTuplesPerPartition(),
+ *                    the vector is neither sorted nor modified. Writes the file on root only
+ */
+template <uint8_t keyLayer , typename T>
+void generatePartitionSizeHistogram(const typename std::vector<T>& localVector, std::string filename, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  std::vector<partitionStat_t> statsVector;
+  countTuplesPerPartition<keyLayer, partitionStatTuple::kmers>(localVector, statsVector);
 
+  auto mergedStats = mergePartitionStats(statsVector, comm);
+  generateHistogramFromPartitionStats<partitionStatTuple::kmers>(mergedStats, filename, "", comm);
+}
 
 #endif
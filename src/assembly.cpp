@@ -22,12 +22,17 @@
 #include "utils.hpp"
 #include "preProcess.hpp"
 #include "postProcess.hpp"
+#include "splitGiantComponent.hpp"
+#include "kmerIndex.hpp"
+#include "classifierIndex.hpp"
+#include "commStats.hpp"
 #include "argvparser.h"
 
 #include <mxx/collective.hpp>
 #include <mxx/distribution.hpp>
 #include <mxx/timer.hpp>
 
+#include <memory>
 #include <sstream>
 
 using namespace std;
@@ -54,6 +59,19 @@ int main(int argc, char** argv)
   cmd.defineOption("file", "Name of the dataset in the FASTQ format", ArgvParser::OptionRequiresValue | ArgvParser::OptionRequired);
   cmd.defineOption("velvetK", "Kmer length to pass while running velvet", ArgvParser::OptionRequiresValue | ArgvParser::OptionRequired);
   cmd.defineOption("assemblyOff", "Optional. No value required.", ArgvParser::NoOptionAttribute);
+  cmd.defineOption("assemblers", "Optional. Count of assembler jobs each rank runs concurrently (default 1)", ArgvParser::OptionRequiresValue);
+  cmd.defineOption("pipeline", "Optional. No value required. Assemble the partitions finished early while partitioning continues", ArgvParser::NoOptionAttribute);
+  cmd.defineOption("splitGiant", "Optional. No value required. Split the largest partition by removing its high degree kmers before assembly", ArgvParser::NoOptionAttribute);
+  cmd.defineOption("partitionStore", "Optional. Save the partitioned reads in a partition store with this path prefix, for running assemblers later. Works with assemblyOff as well", ArgvParser::OptionRequiresValue);
+  cmd.defineOption("ledger", "Optional. Record the assembled partitions in this directory, so that an interrupted assembly can be resumed. Requires partitionStore", ArgvParser::OptionRequiresValue);
+  cmd.defineOption("resume", "Optional. No value required. Assemble only the partitions of the partition store which the ledger doesn't list, without partitioning again. Requires partitionStore and ledger", ArgvParser::NoOptionAttribute);
+  cmd.defineOption("kmerIndex", "Optional. Save the kmer to partition mapping in a kmer index with this path prefix, for partitioning new reads later with incremental", ArgvParser::OptionRequiresValue);
+  cmd.defineOption("incremental", "Optional. No value required. Partition the reads of the file against the kmer index, merging the indexed partitions they connect, and add them to the index. Requires kmerIndex. Assembly is turned off, the partitions of the new reads are incomplete", ArgvParser::NoOptionAttribute);
+  cmd.defineOption("classifierIndex", "Optional. Save the kmer to partition mapping in a compressed classifier index with this file name, for assigning reads of other samples to the partitions with classifyReads. Can't be used with incremental or splitGiant", ArgvParser::OptionRequiresValue);
+  cmd.defineOption("trace", "Optional. Write the per rank timeline of the timed sections and partitioning iterations to this file in Chrome trace format, for chrome://tracing or Perfetto", ArgvParser::OptionRequiresValue);
+  cmd.defineOption("memoryReport", "Optional. No value required. Report the resident set size, its peak and the capacity of the main vectors at the end of every timed section, as min/max/sum across the ranks", ArgvParser::NoOptionAttribute);
+  cmd.defineOption("memoryBudget", "Optional. Memory allowed per rank in MB, the run aborts once a phase goes or is expected to go past it. Turns on memoryReport", ArgvParser::OptionRequiresValue);
+  cmd.defineOption("schedule", "Optional. Placement of partitions on ranks for assembly: lpt (default, balances estimated assembly cost), dynamic (lpt followed by work stealing among ranks) or contiguous (equal read count per rank)", ArgvParser::OptionRequiresValue);
 
   //Global timer for calculating total time
   mxx::timer t;
@@ -86,6 +104,134 @@ int main(int argc, char** argv)
   else
     cmdLineVals.runAssembler = true;
 
+  if (cmd.foundOption("kmerIndex"))
+  {
+    cmdLineVals.kmerIndexPrefix = cmd.optionValue("kmerIndex");
+    if(!rank) std::cout << "Kmer index : " << cmdLineVals.kmerIndexPrefix << "\n";
+  }
+
+  cmdLineVals.incrementalPartitioning = cmd.foundOption("incremental");
+  if (cmdLineVals.incrementalPartitioning)
+  {
+    if (cmdLineVals.kmerIndexPrefix.empty() || cmd.foundOption("resume") || cmd.foundOption("splitGiant"))
+    {
+      if (!rank) cout << "Option incremental requires kmerIndex, and can't be used with resume or splitGiant\n";
+      exit(1);
+    }
+
+    //Reads of the merged partitions are partly in the earlier runs
+    cmdLineVals.runAssembler = false;
+    if(!rank) std::cout << "Reads partitioned incrementally against the kmer index, assembly turned off\n";
+  }
+
+  if (cmd.foundOption("classifierIndex"))
+  {
+    //Only the kmers of the new reads are known in the incremental mode,
+    //and the split gives the reads of the largest partition ids the index doesn't know
+    if (cmdLineVals.incrementalPartitioning || cmd.foundOption("splitGiant"))
+    {
+      if (!rank) cout << "Option classifierIndex can't be used with incremental or splitGiant\n";
+      exit(1);
+    }
+
+    cmdLineVals.classifierIndexFile = cmd.optionValue("classifierIndex");
+    if(!rank) std::cout << "Classifier index : " << cmdLineVals.classifierIndexFile << "\n";
+  }
+
+  if (cmd.foundOption("trace"))
+  {
+    cmdLineVals.traceFile = cmd.optionValue("trace");
+    if(!rank) std::cout << "Trace file : " << cmdLineVals.traceFile << "\n";
+    MP_TRACE_ENABLE();
+  }
+
+  if (cmd.foundOption("memoryBudget"))
+    cmdLineVals.memoryBudget = std::stoull(cmd.optionValue("memoryBudget")) << 20;
+  else
+    cmdLineVals.memoryBudget = 0;
+
+  if (cmd.foundOption("memoryReport") || cmdLineVals.memoryBudget > 0)
+  {
+    if(!rank && cmdLineVals.memoryBudget > 0) std::cout << "Memory budget per rank : " << (cmdLineVals.memoryBudget >> 20) << " MB\n";
+    MP_MEMORY_ENABLE(cmdLineVals.memoryBudget);
+  }
+
+  if (cmd.foundOption("schedule"))
+    cmdLineVals.assemblySchedule = cmd.optionValue("schedule");
+  else
+    cmdLineVals.assemblySchedule = "lpt";
+
+  if (cmdLineVals.assemblySchedule != "lpt" && cmdLineVals.assemblySchedule != "dynamic" && cmdLineVals.assemblySchedule != "contiguous")
+  {
+    if (!rank) cout << "Unknown schedule " << cmdLineVals.assemblySchedule << ", use lpt, dynamic or contiguous\n";
+    exit(1);
+  }
+
+  if (cmd.foundOption("assemblers"))
+    cmdLineVals.assemblerConcurrency = std::max(std::stoi(cmd.optionValue("assemblers")), 1);
+  else
+    cmdLineVals.assemblerConcurrency = 1;
+
+  cmdLineVals.pipelineAssembly = cmdLineVals.runAssembler && cmd.foundOption("pipeline");
+  if(!rank && cmdLineVals.pipelineAssembly) std::cout << "Assembly pipelined with partitioning\n";
+
+  if (cmd.foundOption("partitionStore"))
+  {
+    cmdLineVals.partitionStorePrefix = cmd.optionValue("partitionStore");
+    if(!rank) std::cout << "Partition store : " << cmdLineVals.partitionStorePrefix << "\n";
+  }
+
+  if (cmd.foundOption("ledger"))
+  {
+    cmdLineVals.ledgerDir = cmd.optionValue("ledger");
+    if(!rank) std::cout << "Assembly ledger : " << cmdLineVals.ledgerDir << "\n";
+  }
+
+  cmdLineVals.resumeAssembly = cmd.foundOption("resume");
+
+  //Resuming needs the partitioned reads along with the record of what was assembled
+  if (!cmdLineVals.ledgerDir.empty() && cmdLineVals.partitionStorePrefix.empty())
+  {
+    if (!rank) cout << "Option ledger requires partitionStore\n";
+    exit(1);
+  }
+
+  if (cmdLineVals.resumeAssembly && (cmdLineVals.ledgerDir.empty() || !cmdLineVals.runAssembler))
+  {
+    if (!rank) cout << "Option resume requires partitionStore and ledger, with assembly turned on\n";
+    exit(1);
+  }
+
+  //Reads of a partition are kept together when resuming
+  if (cmdLineVals.resumeAssembly && cmdLineVals.assemblySchedule == "contiguous")
+    cmdLineVals.assemblySchedule = "lpt";
+
+  cmdLineVals.splitGiant = cmd.foundOption("splitGiant");
+  if(!rank && cmdLineVals.splitGiant) std::cout << "Largest partition will be split\n";
+
+  if(!rank && cmdLineVals.runAssembler) std::cout << "Assembly schedule : " << cmdLineVals.assemblySchedule << "\n";
+  if(!rank && cmdLineVals.runAssembler) std::cout << "Concurrent assembler jobs per rank : " << cmdLineVals.assemblerConcurrency << "\n";
+
+  /*
+   * RESUMED ASSEMBLY, the partitions come from an earlier run
+   */
+  if (cmdLineVals.resumeAssembly)
+  {
+    typedef bliss::common::Kmer<KMER_LEN, bliss::common::DNA, KmerIdType> KmerType;
+    resumeAssemblyFromStore<KmerType>(cmdLineVals);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(!cmdLineVals.traceFile.empty())
+      MP_TRACE_WRITE(cmdLineVals.traceFile);
+    MP_COMM_REPORT("communication.stats");
+
+    double time = t.elapsed() - startTime;
+    if(!rank) std::cerr << "TOTAL time : " << time << " ms.\n";
+
+    MPI_Finalize();
+    return(0);
+  }
+
   /*
    * PREPROCESSING PHASE
    */
@@ -108,6 +254,7 @@ int main(int argc, char** argv)
   std::vector<ReadLenType> readTrimLengths;
 
   //Generate kmer tuples, keep filter off
+  MP_MEMORY_TRACK("Pre-process tuples", localVector_pre);
   MP_TIMER_START();
   readFASTQFile< KmerType_pre, includeAllKmers<KmerType_pre> > (cmdLineVals, localVector_pre, readFilterFlags, readTrimLengths);
   MP_TIMER_END_SECTION("File read for pre-process");
@@ -116,24 +263,24 @@ int main(int argc, char** argv)
   trimReadswithHighMedianOrMaxCoverage<>(localVector_pre, readFilterFlags, readTrimLengths);
   MP_TIMER_END_SECTION("Digital normalization plus High frequency trimming completed");
 
-  //Delete the local vector
-  localVector_pre.resize(0);
-
   //Initialize vector for partioning phase
   typedef typename std::tuple<KmerIdType, PidType, PidType> tuple_t;
   std::vector<tuple_t> localVector;
+  MP_MEMORY_TRACK("Kmer tuples", localVector);
+
+  std::size_t preKmerCount = localVector_pre.size();
+
+  //Delete the local vector, releasing its memory
+  std::vector<tuple_t_pre>().swap(localVector_pre);
+
+  //Partitioning parses about as many kmers, into a vector reserved with some slack
+  MP_MEMORY_PROJECT("File read for partitioning", preKmerCount * sizeof(tuple_t) * 1.1);
 
   //Specify Kmer Type
   const int kmerLength = KMER_LEN;
   typedef bliss::common::Kmer<kmerLength, AlphabetType, KmerIdType> KmerType;
 
 
-  // define k-mer and operator types
-  typedef KmerReduceAndMarkAsInactive<tuple_t> KmerReducerType;
-  typedef PartitionReduceAndMarkAsInactive<tuple_t> PartitionReducerType;
-  ActivePartitionPredicate<tuple_t> app;
-
-
   /*
    * IMPORTANT NOTE
    * Indices inside tuple will go like this:
@@ -143,7 +290,8 @@ int main(int argc, char** argv)
    */
 
   // Populate localVector for each rank and return the vector with all the tuples
-  readFASTQFile< KmerType, includeAllKmersinFilteredReads<KmerType> > (cmdLineVals, localVector, readFilterFlags, readTrimLengths);
+  // Every read also gets a read tag tuple, which tells its partition id after the iterations
+  ReadIdType localReadCount = readFASTQFile< KmerType, includeAllKmersAndReadTagsinFilteredReads<KmerType> > (cmdLineVals, localVector, readFilterFlags, readTrimLengths);
   MP_TIMER_END_SECTION("File read for partitioning");
 
 
@@ -151,65 +299,149 @@ int main(int argc, char** argv)
   mxx::block_decompose(localVector);
 
   assert(localVector.size() > 0);
-  auto start = localVector.begin();
-  auto end = localVector.end();
-  auto pend = end;
-
-
-  //Sort tuples by KmerId
-  bool keepGoing = true;
-  int countIterations = 0;
-  while (keepGoing) {
-
-    // sort by k-mers and update Pn
-    mxx::sort(start, pend, layer_comparator<kmerTuple::kmer, tuple_t>(), MPI_COMM_WORLD, true);
-    KmerReducerType r1;
-    r1(start, pend, MPI_COMM_WORLD);
-
-    // sort by P_c and update P_c via P_n
-    mxx::sort(start, pend, layer_comparator<kmerTuple::Pc, tuple_t>(), MPI_COMM_WORLD, true);
-    PartitionReducerType r2;
-    r2(start, pend, MPI_COMM_WORLD);
-
-    // check for global termination
-    keepGoing = !checkTermination<kmerTuple::Pn, tuple_t>(start, pend, MPI_COMM_WORLD);
-
-    if (keepGoing) {
-      // now reduce to only working with active partitions
-      pend = std::partition(start, pend, app);
-      // re-shuffle the partitions to counter-act the load-inbalance
-      pend = mxx::block_decompose_partitions(start, pend, end);
-    }
 
-    countIterations++;
-    if(!rank)
-      std::cout << "[RANK 0] : Iteration # " << countIterations <<"\n";
+  //Sorts during the iterations need a buffer as large as the tuples
+  MP_MEMORY_PROJECT("Partitioning iterations", localVector.size() * sizeof(tuple_t));
+
+  //Partitions finished early are assembled during the remaining iterations in the pipelined mode
+  std::unique_ptr< AssemblyPipeline<KmerType> > pipeline;
+  std::vector<tuple_t> finishedReadTags;
+  MP_MEMORY_TRACK("Finished read tags", finishedReadTags);
+  uint64_t handOffReadCount = 0;
+
+  //Partial kmer and read counts of the partitions, read tags handed over early are counted before they go
+  std::vector<partitionStat_t> partitionStats;
+
+  if(cmdLineVals.pipelineAssembly)
+  {
+    pipeline.reset(new AssemblyPipeline<KmerType>(readFilterFlags, readTrimLengths, localReadCount, cmdLineVals));
+
+    //Hand-offs are sized by the reads which have kmers, i.e. the read tags
+    uint64_t localReadTagCount = std::count_if(localVector.begin(), localVector.end(),
+        [](const tuple_t &t){ return std::get<kmerTuple::kmer>(t) & READ_TAG;});
+    handOffReadCount = PIPELINE_HANDOFF_READ_FRACTION * mxx::allreduce(localReadTagCount);
   }
 
-  //Lets ensure Pn and Pc are equal for every tuple
-  //This was not ensured during the program run
-  std::for_each(localVector.begin(), localVector.end(), [](tuple_t &t){ std::get<kmerTuple::Pn>(t) = std::get<kmerTuple::Pc>(t);});
+  //Run the partitioning iterations
+  int countIterations = runPartitioningIterations(localVector, 
+      [&](std::vector<tuple_t>& vec, std::size_t activeCount, std::size_t pendCount) {
+        if (pipeline) {
+          // pull out the read tags of the partitions finished in this iteration
+          auto tagStart = std::partition(vec.begin() + activeCount, vec.begin() + pendCount, 
+              [](const tuple_t &t){ return !(std::get<kmerTuple::kmer>(t) & READ_TAG);});
+          std::size_t tagCount = vec.begin() + pendCount - tagStart;
+          finishedReadTags.insert(finishedReadTags.end(), tagStart, vec.begin() + pendCount);
+
+          // fill their place with the last inactive tuples, order of the inactive tuples doesn't matter
+          std::size_t fillCount = std::min(tagCount, (std::size_t)(vec.end() - (vec.begin() + pendCount)));
+          std::move(vec.end() - fillCount, vec.end(), tagStart);
+          vec.resize(vec.size() - tagCount);
+
+          // assemble them once there are enough, while the rest keeps iterating
+          uint64_t finishedReadCount = mxx::allreduce((uint64_t)finishedReadTags.size());
+          if (finishedReadCount > 0 && finishedReadCount >= handOffReadCount)
+          {
+            countTuplesPerPartition<kmerTuple::Pc, partitionStatTuple::reads>(finishedReadTags, partitionStats);
+            pipeline->handOff(finishedReadTags, true);
+
+            // every hand-off parses the input file, so they get fewer as they get bigger
+            handOffReadCount *= 2;
+          }
+
+          pipeline->poll();
+        }
+      });
+
+  //Move the read tags out of the kmer tuples, they give the read to partition mapping
+  auto tagStart = std::partition(localVector.begin(), localVector.end(), 
+      [](const tuple_t &t){ return !(std::get<kmerTuple::kmer>(t) & READ_TAG);});
+  std::vector<tuple_t> readTagVector(tagStart, localVector.end());
+  localVector.erase(tagStart, localVector.end());
+  MP_MEMORY_TRACK("Read tags", readTagVector);
 
 
   std::string histFileName = "partitionKmer.hist";
+  std::string summaryFileName = "partitionKmer.summary";
 
   if(!rank)
   {
     std::cout << "Algorithm took " << countIterations << " iteration.\n";
-    std::cout << "Generating kmer histogram in file " << histFileName << "\n";
+    std::cout << "Generating kmer histogram in file " << histFileName << " and summary in file " << summaryFileName << "\n";
   }
   MP_TIMER_END_SECTION("Partitioning completed");
 
-  generatePartitionSizeHistogram<kmerTuple::Pc>(localVector, histFileName);
+  //Partitions of the new reads join the indexed ones they connect, or the partitioning result is indexed
+  if(cmdLineVals.incrementalPartitioning)
+  {
+    mergeWithKmerIndex(localVector, readTagVector, localReadCount, cmdLineVals.kmerIndexPrefix);
+    MP_TIMER_END_SECTION("Partitions merged with the kmer index");
+  }
+  else if(!cmdLineVals.kmerIndexPrefix.empty())
+  {
+    writeKmerIndex(localVector, localReadCount, cmdLineVals.kmerIndexPrefix);
+    MP_TIMER_END_SECTION("Kmer index written");
+  }
+
+  if(!cmdLineVals.classifierIndexFile.empty())
+  {
+    writeClassifierIndex(localVector, cmdLineVals.classifierIndexFile);
+    MP_TIMER_END_SECTION("Classifier index written");
+  }
+
+  //Counted by hashing the pids, the kmer tuples are not sorted again
+  countTuplesPerPartition<kmerTuple::Pc, partitionStatTuple::kmers>(localVector, partitionStats);
+  countTuplesPerPartition<kmerTuple::Pc, partitionStatTuple::reads>(readTagVector, partitionStats);
+  countTuplesPerPartition<kmerTuple::Pc, partitionStatTuple::reads>(finishedReadTags, partitionStats);
+  partitionStats = mergePartitionStats(partitionStats);
+
+  //Partitions of read tags only have no kmers, they are left out as before
+  partitionStats.erase(std::remove_if(partitionStats.begin(), partitionStats.end(),
+        [](const partitionStat_t& x){ return std::get<partitionStatTuple::kmers>(x) == 0;}), partitionStats.end());
+
+  //List partitions under the ids of the partition store and partitionRead.summary
+  for(auto &x : partitionStats)
+    std::get<partitionStatTuple::pid>(x) = hashPartitionId(std::get<partitionStatTuple::pid>(x));
+
+  generateHistogramFromPartitionStats<partitionStatTuple::kmers>(partitionStats, histFileName, summaryFileName);
+  std::vector<partitionStat_t>().swap(partitionStats);
 
   MP_TIMER_END_SECTION("Kmer Partition size histogram generated");
 
-  if(cmdLineVals.runAssembler == true)
-    finalPostProcessing<KmerType>(localVector, readFilterFlags, readTrimLengths, cmdLineVals);
+  //Kmer tuples are not needed anymore
+  std::vector<tuple_t>().swap(localVector);
 
-  MPI_Barrier(MPI_COMM_WORLD);
+  //Rest of the partitions go along with the ones finished early but not handed over yet,
+  //so that the split sees all the reads left for assembly
+  readTagVector.insert(readTagVector.end(), finishedReadTags.begin(), finishedReadTags.end());
+  std::vector<tuple_t>().swap(finishedReadTags);
+
+  if(cmdLineVals.splitGiant)
+  {
+    splitGiantComponent<KmerType>(readTagVector, readFilterFlags, readTrimLengths, localReadCount, cmdLineVals);
+    MP_TIMER_END_SECTION("Largest partition split");
+  }
+
+  if(pipeline)
+  {
+    pipeline->handOff(readTagVector);
+    pipeline->finish();
+  }
+  else if(cmdLineVals.runAssembler == true || !cmdLineVals.partitionStorePrefix.empty())
+    finalPostProcessing<KmerType>(readTagVector, readFilterFlags, readTrimLengths, localReadCount, cmdLineVals);
+
+  {
+    //Ranks finishing their assemblies early wait here
+    MP_TRACE_COLLECTIVE("Assembly barrier");
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
   MP_TIMER_END_SECTION("Parallel assembly phase completed");
 
+  if(!cmdLineVals.traceFile.empty())
+    MP_TRACE_WRITE(cmdLineVals.traceFile);
+
+  //Communication of every section and iteration, in builds with METAG_COMM_STATS
+  MP_COMM_REPORT("communication.stats");
+
   double time = t.elapsed() - startTime;
   if(!rank)
   {
@@ -0,0 +1,507 @@
+/**
+ * @file    benchmarkKernels.cpp
+ * @ingroup group
+ * @brief   Microbenchmarks of the hot kernels of partitioning on synthetic inputs, on a single rank.
+ *          Reports the time per item of every kernel, so that changes to these loops can be compared
+ *
+ * Copyright (c) 2015 Georgia Institute of Technology. All Rights Reserved.
+ */
+
+//Includes
+#include <mpi.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "configParam.hpp"
+#include "argvparser.h"
+
+//File includes from BLISS
+#include <common/kmer.hpp>
+#include <common/base_types.hpp>
+#include <iterators/transform_iterator.hpp>
+
+//Own includes
+#include "parallel_fastq_iterate.hpp"
+#include "packedRead.hpp"
+#include "preProcess.hpp"
+#include "sortTuples.hpp"
+#include "graph500-utils.hpp"
+
+using namespace CommandLineProcessing;
+
+//Length of the synthetic reads, below MAX_READ_SIZE
+const std::size_t BENCHMARK_READ_LENGTH = 100;
+
+//Kernels add their results here, so that the compiler keeps them
+volatile uint64_t benchmarkSink = 0;
+
+/*
+ * @brief     Runs the kernels and prints min/median/max time per item of the repetitions
+ * @details   Every repetition calls setup() first, which is not timed, so kernels that modify their input
+ *            get a fresh copy. A first repetition warms up the caches and is not reported
+ */
+class kernelBenchmark
+{
+  private:
+    int repetitions;
+    std::string filter;
+    std::ofstream csv;
+
+  public:
+    kernelBenchmark(int repetitions_, const std::string& filter_, const std::string& csvFile)
+      : repetitions(std::max(repetitions_, 1)), filter(filter_)
+    {
+      if(!csvFile.empty())
+      {
+        csv.open(csvFile, std::ios_base::out);
+        csv << "kernel,items,unit,min_ns,median_ns,max_ns\n";
+      }
+
+      std::printf("%-52s %10s %-7s %10s %10s %10s\n", "kernel", "items", "unit", "min ns", "median ns", "max ns");
+    }
+
+    //Kernels run only if the filter is empty or part of their name
+    bool selected(const std::string& name) const
+    {
+      return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    template <typename Setup, typename Kernel>
+    void run(const std::string& name, uint64_t items, const char* unit, Setup setup, Kernel kernel)
+    {
+      if(!selected(name) || items == 0)
+        return;
+
+      setup();
+      kernel();
+
+      std::vector<double> nsPerItem;
+      for(int r = 0; r < repetitions; r++)
+      {
+        setup();
+        auto begin = std::chrono::steady_clock::now();
+        kernel();
+        auto end = std::chrono::steady_clock::now();
+        nsPerItem.push_back(std::chrono::duration<double, std::nano>(end - begin).count() / items);
+      }
+
+      std::sort(nsPerItem.begin(), nsPerItem.end());
+      double median = nsPerItem[nsPerItem.size() / 2];
+
+      std::printf("%-52s %10llu %-7s %10.2f %10.2f %10.2f\n", name.c_str(), (unsigned long long)items, unit,
+          nsPerItem.front(), median, nsPerItem.back());
+      std::fflush(stdout);
+
+      if(csv.is_open())
+        csv << name << "," << items << "," << unit << "," << nsPerItem.front() << "," << median << "," << nsPerItem.back() << "\n";
+    }
+};
+
+/*
+ * @brief     Sizes of the buckets of a sorted vector, summing to elements
+ * @details   singleton   Every key once, as kmers seen once
+ *            coverage    Poisson around 12, as kmers of a read set with moderate coverage
+ *            powerlaw    Pareto distributed, as partitions of a metagenome: mostly small with a few giant ones
+ */
+std::vector<uint64_t> bucketSizes(const std::string& distribution, uint64_t elements, std::mt19937_64& gen)
+{
+  std::poisson_distribution<uint64_t> coverage(12);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  std::vector<uint64_t> sizes;
+  uint64_t total = 0;
+  while(total < elements)
+  {
+    uint64_t size = 1;
+    if(distribution == "coverage")
+      size = coverage(gen) + 1;
+    else if(distribution == "powerlaw")
+      size = std::min<double>(elements / 4, std::floor(std::pow(1.0 - uniform(gen), -1.0 / 1.2)));
+
+    size = std::min(std::max<uint64_t>(size, 1), elements - total);
+    sizes.push_back(size);
+    total += size;
+  }
+  return sizes;
+}
+
+/*
+ * @brief     Kmer tuples sorted by the kmer layer, with the buckets of a distribution
+ * @details   Half of the kmers have a single Pc (internal kmers), the others span a few partitions.
+ *            Pn starts equal to Pc, as the tuples of an active partition
+ */
+template <typename T>
+std::vector<T> kmerSortedTuples(const std::vector<uint64_t>& sizes, std::mt19937_64& gen)
+{
+  std::uniform_int_distribution<PidType> pid(0, std::max<std::size_t>(sizes.size(), 2) - 1);
+  std::bernoulli_distribution internal(0.5);
+
+  std::vector<T> tuples;
+  for(std::size_t b = 0; b < sizes.size(); b++)
+  {
+    bool isInternal = internal(gen);
+    PidType bucketPid = pid(gen);
+    for(uint64_t i = 0; i < sizes[b]; i++)
+    {
+      PidType pc = isInternal ? bucketPid : pid(gen);
+      tuples.emplace_back(KmerIdType(b) * 2654435761u, pc, pc);
+    }
+  }
+  return tuples;
+}
+
+/*
+ * @brief     Kmer tuples sorted by the Pc layer, with the partitions of a distribution
+ * @details   A third of the partitions hold only internal kmers (Pn = TMAX-1) and become inactive, the
+ *            kmers of the others point to a partition id not larger than their own
+ */
+template <typename T>
+std::vector<T> partitionSortedTuples(const std::vector<uint64_t>& sizes, std::mt19937_64& gen)
+{
+  const PidType internalPid = std::numeric_limits<PidType>::max() - 1;
+  std::bernoulli_distribution inactive(1.0 / 3), internal(0.7);
+
+  std::vector<T> tuples;
+  for(std::size_t b = 0; b < sizes.size(); b++)
+  {
+    bool isInactive = inactive(gen);
+    std::uniform_int_distribution<PidType> smallerPid(0, b);
+    for(uint64_t i = 0; i < sizes[b]; i++)
+    {
+      PidType pn = (isInactive || internal(gen)) ? internalPid : smallerPid(gen);
+      tuples.emplace_back(KmerIdType(i), pn, PidType(b));
+    }
+  }
+  return tuples;
+}
+
+/*
+ * @brief     Times a fillValuesfromReads policy over all the reads, as readFASTQFile calls it
+ */
+template <typename KmerType, typename Policy, typename T>
+void benchmarkFillPolicy(kernelBenchmark& bench, const std::string& name, const std::vector<std::string>& reads,
+                         std::vector<bool>& readFilterFlags, std::vector<ReadLenType>& readTrimLengths)
+{
+  if(!bench.selected(name))
+    return;
+
+  using Alphabet = typename KmerType::KmerAlphabet;
+  using BaseCharIterator = bliss::iterator::transform_iterator<std::string::const_iterator, bliss::common::ASCII2<Alphabet> >;
+
+  Policy policy;
+  std::vector<T> localVector;
+  policy.reserveSpace(localVector, reads.size() * (BENCHMARK_READ_LENGTH - KmerType::size + 1), reads.size());
+
+  bench.run(name, reads.size(), "read",
+      [&]() { localVector.clear(); },
+      [&]() {
+        for(std::size_t i = 0; i < reads.size(); i++)
+          policy.fillValuesfromReads(localVector, BaseCharIterator(reads[i].begin(), bliss::common::ASCII2<Alphabet>()),
+              BaseCharIterator(reads[i].end(), bliss::common::ASCII2<Alphabet>()), readFilterFlags, readTrimLengths, ReadIdType(i));
+        benchmarkSink += localVector.size();
+      });
+}
+
+int main(int argc, char** argv)
+{
+  // Initialize the MPI library:
+  MPI_Init(&argc, &argv);
+
+  int p;
+  MPI_Comm_size(MPI_COMM_WORLD, &p);
+
+  //Parse command line arguments
+  ArgvParser cmd;
+
+  cmd.setIntroductoryDescription("Microbenchmarks of the partitioning kernels on synthetic inputs, run on a single rank");
+  cmd.setHelpOption("h", "help", "Print this help page");
+
+  cmd.defineOption("size", "Optional. Count of tuples in the inputs of the tuple kernels (default 1048576)", ArgvParser::OptionRequiresValue);
+  cmd.defineOption("reads", "Optional. Count of synthetic reads of the read kernels (default 16384)", ArgvParser::OptionRequiresValue);
+  cmd.defineOption("repeat", "Optional. Timed repetitions of every kernel (default 10)", ArgvParser::OptionRequiresValue);
+  cmd.defineOption("filter", "Optional. Run only the kernels whose name contains this string", ArgvParser::OptionRequiresValue);
+  cmd.defineOption("csv", "Optional. Also write the results to this CSV file, for comparing runs", ArgvParser::OptionRequiresValue);
+
+  int result = cmd.parse(argc, argv);
+
+  if (result != ArgvParser::NoParserError)
+  {
+    std::cout << cmd.parseErrorDescription(result) << "\n";
+    exit(1);
+  }
+
+  if(p != 1)
+  {
+    std::cerr << "Kernels are benchmarked on a single rank, run with 1 process\n";
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  uint64_t size = cmd.foundOption("size") ? std::stoull(cmd.optionValue("size")) : (1 << 20);
+  std::size_t readCount = cmd.foundOption("reads") ? std::stoull(cmd.optionValue("reads")) : (1 << 14);
+  int repetitions = cmd.foundOption("repeat") ? std::stoi(cmd.optionValue("repeat")) : 10;
+
+  std::string filter = cmd.foundOption("filter") ? cmd.optionValue("filter") : "";
+  std::string csvFile = cmd.foundOption("csv") ? cmd.optionValue("csv") : "";
+
+  kernelBenchmark bench(repetitions, filter, csvFile);
+
+  //Same inputs in every run
+  std::mt19937_64 gen(12345);
+
+  typedef bliss::common::DNA AlphabetType;
+  typedef bliss::common::Kmer<KMER_LEN_PRE, AlphabetType, KmerIdType> KmerType_pre;
+  typedef bliss::common::Kmer<KMER_LEN, AlphabetType, KmerIdType> KmerType;
+  typedef std::tuple<KmerIdType, ReadIdType, KmerFreqType, KmerSNoType> tuple_t_pre;
+  typedef std::tuple<KmerIdType, PidType, PidType> tuple_t;
+
+  /*
+   * FINDRANGE
+   * Scans a sorted vector bucket by bucket, as the reductions do
+   */
+  for(const std::string distribution : {"singleton", "coverage", "powerlaw"})
+  {
+    std::string name = "findRange/" + distribution;
+    if(!bench.selected(name))
+      continue;
+
+    auto tuples = kmerSortedTuples<tuple_t>(bucketSizes(distribution, size, gen), gen);
+    layer_comparator<kmerTuple::kmer, tuple_t> kmerCmp;
+
+    bench.run(name, tuples.size(), "tuple", [](){},
+        [&]() {
+          uint64_t buckets = 0;
+          for(auto it = tuples.begin(); it != tuples.end();)
+          {
+            it = findRange(it, tuples.end(), *it, kmerCmp).second;
+            buckets++;
+          }
+          benchmarkSink += buckets;
+        });
+  }
+
+  /*
+   * REDUCTIONS OF THE PARTITIONING ITERATIONS
+   */
+  for(const std::string distribution : {"coverage", "powerlaw"})
+  {
+    std::string name = "KmerReduceAndMarkAsInactive/" + distribution;
+    if(!bench.selected(name))
+      continue;
+
+    auto input = kmerSortedTuples<tuple_t>(bucketSizes(distribution, size, gen), gen);
+    std::vector<tuple_t> tuples(input.size());
+    KmerReduceAndMarkAsInactive<tuple_t> reducer;
+
+    bench.run(name, tuples.size(), "tuple",
+        [&]() { std::copy(input.begin(), input.end(), tuples.begin()); },
+        [&]() {
+          reducer(tuples.begin(), tuples.end(), MPI_COMM_WORLD);
+          benchmarkSink += std::get<kmerTuple::Pn>(tuples.back());
+        });
+  }
+
+  for(const std::string distribution : {"coverage", "powerlaw"})
+  {
+    std::string name = "PartitionReduceAndMarkAsInactive/" + distribution;
+    if(!bench.selected(name))
+      continue;
+
+    auto input = partitionSortedTuples<tuple_t>(bucketSizes(distribution, size, gen), gen);
+    std::vector<tuple_t> tuples(input.size());
+    PartitionReduceAndMarkAsInactive<tuple_t> reducer;
+
+    bench.run(name, tuples.size(), "tuple",
+        [&]() { std::copy(input.begin(), input.end(), tuples.begin()); },
+        [&]() {
+          reducer(tuples.begin(), tuples.end(), MPI_COMM_WORLD);
+          benchmarkSink += std::get<kmerTuple::Pc>(tuples.back());
+        });
+  }
+
+  /*
+   * PARSING OF THE READS
+   */
+  std::vector<std::string> reads(readCount, std::string(BENCHMARK_READ_LENGTH, 'A'));
+  {
+    const char bases[] = "ACGT";
+    std::uniform_int_distribution<int> base(0, 3);
+    for(auto& read : reads)
+      for(auto& c : read)
+        c = bases[base(gen)];
+  }
+
+  //Most reads are kept whole, the others trimmed or removed as after the pre-processing
+  std::vector<bool> readFilterFlags(readCount, true);
+  std::vector<ReadLenType> readTrimLengths(readCount, 0);
+  {
+    std::uniform_int_distribution<int> percent(0, 99);
+    for(std::size_t i = 0; i < readCount; i++)
+    {
+      int x = percent(gen);
+      if(x < 10)
+      {
+        readFilterFlags[i] = false;
+        readTrimLengths[i] = (x < 5) ? 0 : BENCHMARK_READ_LENGTH * 3 / 5;
+      }
+    }
+  }
+
+  benchmarkFillPolicy<KmerType_pre, includeAllKmers<KmerType_pre>, tuple_t_pre>(bench,
+      "fillValuesfromReads/includeAllKmers", reads, readFilterFlags, readTrimLengths);
+  benchmarkFillPolicy<KmerType, includeAllKmersinAllReads<KmerType>, tuple_t>(bench,
+      "fillValuesfromReads/includeAllKmersinAllReads", reads, readFilterFlags, readTrimLengths);
+  benchmarkFillPolicy<KmerType, includeAllKmersAndReadTagsinFilteredReads<KmerType>, tuple_t>(bench,
+      "fillValuesfromReads/includeAllKmersAndReadTags", reads, readFilterFlags, readTrimLengths);
+
+  //Read storage as during the assembly
+  typedef readStorageInfo<typename KmerType::KmerAlphabet, typename KmerType::KmerWordType> ReadSeqTypeInfo;
+  typedef std::array<typename ReadSeqTypeInfo::ReadWordType, ReadSeqTypeInfo::nWords> ReadSeqType;
+  typedef std::tuple<ReadSeqType, ReadIdType, PidType, uint32_t> readTuple_t;
+
+  benchmarkFillPolicy<KmerType, includeWholeReadinFilteredReads<KmerType>, readTuple_t>(bench,
+      "fillValuesfromReads/includeWholeReadinFilteredReads", reads, readFilterFlags, readTrimLengths);
+
+  /*
+   * PACKING OF THE READS
+   */
+  {
+    using BaseCharIterator = bliss::iterator::transform_iterator<std::string::const_iterator, bliss::common::ASCII2<AlphabetType> >;
+
+    std::vector<ReadSeqType> packed(readCount);
+    std::string unpacked(readCount * BENCHMARK_READ_LENGTH, ' ');
+    std::string unpackedScalar(readCount * BENCHMARK_READ_LENGTH, ' ');
+
+    auto clearPacked = [&]() { std::fill(packed.begin(), packed.end(), ReadSeqType()); };
+
+    bench.run("getPackedRead", readCount, "read", clearPacked,
+        [&]() {
+          for(std::size_t i = 0; i < readCount; i++)
+            getPackedRead<ReadSeqTypeInfo>(packed[i], BaseCharIterator(reads[i].begin(), bliss::common::ASCII2<AlphabetType>()),
+                BaseCharIterator(reads[i].end(), bliss::common::ASCII2<AlphabetType>()));
+          benchmarkSink += packed.back()[0];
+        });
+
+    bench.run("getPackedReadScalar", readCount, "read", clearPacked,
+        [&]() {
+          for(std::size_t i = 0; i < readCount; i++)
+            getPackedReadScalar<ReadSeqTypeInfo>(packed[i], BaseCharIterator(reads[i].begin(), bliss::common::ASCII2<AlphabetType>()),
+                BaseCharIterator(reads[i].end(), bliss::common::ASCII2<AlphabetType>()));
+          benchmarkSink += packed.back()[0];
+        });
+
+    //Unpacking starts from the packed reads
+    clearPacked();
+    for(std::size_t i = 0; i < readCount; i++)
+      getPackedRead<ReadSeqTypeInfo>(packed[i], BaseCharIterator(reads[i].begin(), bliss::common::ASCII2<AlphabetType>()),
+          BaseCharIterator(reads[i].end(), bliss::common::ASCII2<AlphabetType>()));
+
+    bench.run("getUnPackedRead", readCount, "read", [](){},
+        [&]() {
+          for(std::size_t i = 0; i < readCount; i++)
+            getUnPackedRead<ReadSeqTypeInfo>(packed[i], BENCHMARK_READ_LENGTH, &unpacked[i * BENCHMARK_READ_LENGTH]);
+          benchmarkSink += unpacked[0];
+        });
+
+    bench.run("getUnPackedReadScalar", readCount, "read", [](){},
+        [&]() {
+          for(std::size_t i = 0; i < readCount; i++)
+            getUnPackedReadScalar<ReadSeqTypeInfo>(packed[i], BENCHMARK_READ_LENGTH, &unpackedScalar[i * BENCHMARK_READ_LENGTH]);
+          benchmarkSink += unpackedScalar[0];
+        });
+
+    //The kernels are only worth timing if they give back the reads
+    auto checkUnpacked = [&](const std::string& name, const std::string& output) {
+      for(std::size_t i = 0; i < readCount && bench.selected(name); i++)
+        if(output.compare(i * BENCHMARK_READ_LENGTH, BENCHMARK_READ_LENGTH, reads[i]) != 0)
+        {
+          std::cerr << "Read " << i << " changed after packing and " << name << "\n";
+          MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    };
+    checkUnpacked("getUnPackedRead", unpacked);
+    checkUnpacked("getUnPackedReadScalar", unpackedScalar);
+  }
+
+  /*
+   * DIGITAL NORMALIZATION
+   * Kmer tuples of the reads ordered by kmer with their frequencies, as after the first counting pass.
+   * Reads have a coverage around which their kmer frequencies vary, a few of them a high one
+   */
+  if(bench.selected("updateReadFilterFlags"))
+  {
+    std::vector<tuple_t_pre> input;
+    std::lognormal_distribution<double> readCoverage(1.5, 1.0);
+    const std::size_t kmersPerRead = BENCHMARK_READ_LENGTH - KMER_LEN_PRE + 1;
+
+    for(std::size_t i = 0; i < readCount; i++)
+    {
+      std::poisson_distribution<int> frequency(std::max(readCoverage(gen), 1.0));
+      for(std::size_t k = 0; k < kmersPerRead; k++)
+        input.emplace_back(gen(), ReadIdType(i), std::min<int>(frequency(gen) + 1, MAX_FREQ - 1), KmerSNoType(k));
+    }
+    std::sort(input.begin(), input.end(), layer_comparator<kmerTuple_Pre::kmer, tuple_t_pre>());
+
+    std::vector<tuple_t_pre> tuples(input.size());
+    std::vector<bool> flags(readCount);
+    std::vector<ReadLenType> trimLengths(readCount);
+    auto copyInput = [&]() { std::copy(input.begin(), input.end(), tuples.begin()); };
+
+    //Filters report the removed reads on every call
+    std::ostringstream discarded;
+    auto cerrBuffer = std::cerr.rdbuf(discarded.rdbuf());
+
+    bench.run("updateReadFilterFlags/median", tuples.size(), "tuple", copyInput,
+        [&]() {
+          updateReadFilterFlags<kmerTuple_Pre::freq, kmerTuple_Pre::rid, kmerTuple_Pre::kmer_sno, true, false>(tuples, flags, trimLengths, 0);
+          benchmarkSink += flags[0];
+        });
+
+    bench.run("updateReadFilterFlags/max", tuples.size(), "tuple", copyInput,
+        [&]() {
+          updateReadFilterFlags<kmerTuple_Pre::freq, kmerTuple_Pre::rid, kmerTuple_Pre::kmer_sno, false, true>(tuples, flags, trimLengths, 0);
+          benchmarkSink += flags[0];
+        });
+
+    std::cerr.rdbuf(cerrBuffer);
+  }
+
+  /*
+   * GRAPH500 INPUT
+   * Random edges among size/8 vertices, stored as the generator does
+   */
+  if(bench.selected("ensure_undirected_and_self_looping"))
+  {
+    typedef std::tuple<int64_t, int64_t, int64_t> edge_t;
+    std::uniform_int_distribution<int64_t> vertex(0, std::max<int64_t>(size / 8, 2) - 1);
+
+    std::vector<edge_t> input;
+    for(uint64_t i = 0; i < size; i++)
+    {
+      int64_t src = vertex(gen);
+      input.emplace_back(src, vertex(gen), src);
+    }
+
+    std::vector<edge_t> edges;
+    bench.run("ensure_undirected_and_self_looping", input.size(), "edge",
+        [&]() {
+          edges.clear();
+          edges.reserve(2 * input.size() + size / 8);
+          edges.insert(edges.end(), input.begin(), input.end());
+        },
+        [&]() {
+          ensure_undirected_and_self_looping(edges);
+          benchmarkSink += edges.size();
+        });
+  }
+
+  MPI_Finalize();
+  return(0);
+}
@@ -0,0 +1,164 @@
+/**
+ * @file    classifyReads.cpp
+ * @ingroup group
+ * @brief   Assigns the reads of a FASTQ file to the partitions of a classifier index written by metaG --classifierIndex.
+ *          Every canonical kmer of a read found in the index votes for its partition
+ *
+ * Copyright (c) 2015 Georgia Institute of Technology. All Rights Reserved.
+ */
+
+//Includes
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//File includes from BLISS
+#include <common/kmer.hpp>
+#include <common/kmer_iterators.hpp>
+#include <common/base_types.hpp>
+#include <iterators/transform_iterator.hpp>
+
+//Own includes
+#include "configParam.hpp"
+#include "classifierIndex.hpp"
+
+//Reads classified together, the output of a batch is printed in input order
+const std::size_t CLASSIFIER_BATCH_READS = 1 << 14;
+
+/*
+ * @brief     Votes of the kmers of a read, formatted as "<name> <kmer count> <pid>:<votes> ..." with most
+ *            votes first, or "*" in place of the votes if no kmer is indexed
+ * @details   Kmers are generated and made canonical the same way as during partitioning (see parallel_fastq_iterate.hpp)
+ */
+template <typename KmerType>
+void classifyRead(const ClassifierIndexReader& index, const std::string& name, const std::string& seq,
+                  std::vector<uint64_t>& pids, std::string& output)
+{
+  using Alphabet = typename KmerType::KmerAlphabet;
+  using BaseCharIterator = bliss::iterator::transform_iterator<std::string::const_iterator, bliss::common::ASCII2<Alphabet> >;
+  using KmerIterType = bliss::common::KmerGenerationIterator<BaseCharIterator, KmerType>;
+
+  pids.clear();
+  uint64_t kmerCount = 0;
+
+  if(seq.size() >= KmerType::size)
+  {
+    KmerIterType start(BaseCharIterator(seq.begin(), bliss::common::ASCII2<Alphabet>()), true);
+    KmerIterType end(BaseCharIterator(seq.end(), bliss::common::ASCII2<Alphabet>()), false);
+
+    for(; start != end; ++start, kmerCount++)
+    {
+      auto originalKmer = *start;
+      auto reversedKmer = (*start).reverse_complement();
+      auto canonicalKmer = (originalKmer < reversedKmer) ? originalKmer : reversedKmer;
+
+      uint64_t pid;
+      if(index.lookup(canonicalKmer.getPrefix(), pid))
+        pids.push_back(pid);
+    }
+  }
+
+  //Pairs of <votes, pid>
+  std::sort(pids.begin(), pids.end());
+  std::vector<std::pair<uint64_t, uint64_t>> votes;
+  for(auto it = pids.begin(); it != pids.end();)
+  {
+    auto runEnd = std::upper_bound(it, pids.end(), *it);
+    votes.emplace_back(runEnd - it, *it);
+    it = runEnd;
+  }
+  std::sort(votes.begin(), votes.end(), [](const std::pair<uint64_t, uint64_t>& x, const std::pair<uint64_t, uint64_t>& y) {
+      return x.first > y.first || (x.first == y.first && x.second < y.second);});
+
+  output = name + "\t" + std::to_string(kmerCount) + "\t";
+  if(votes.empty())
+    output += "*";
+  for(std::size_t i = 0; i < votes.size(); i++)
+    output += (i ? " " : "") + std::to_string(votes[i].second) + ":" + std::to_string(votes[i].first);
+  output += "\n";
+}
+
+int main(int argc, char** argv)
+{
+  if(argc < 3)
+  {
+    std::cout << "Usage : \n";
+    std::cout << "<executable> <classifierIndex> <fastqFile> [<threads>]   Prints the partition votes of every read, use - for stdin\n";
+    return 1;
+  }
+
+  typedef bliss::common::DNA AlphabetType;
+  typedef bliss::common::Kmer<KMER_LEN, AlphabetType, KmerIdType> KmerType;
+
+  ClassifierIndexReader index;
+  std::string error;
+  if(!index.open(argv[1], error))
+  {
+    std::cerr << error << "\n";
+    return 1;
+  }
+
+  std::ifstream ifs;
+  std::string fastqFile = argv[2];
+  if(fastqFile != "-")
+  {
+    ifs.open(fastqFile);
+    if(!ifs)
+    {
+      std::cerr << "Can not open " << fastqFile << "\n";
+      return 1;
+    }
+  }
+  std::istream& in = (fastqFile != "-") ? ifs : std::cin;
+
+  unsigned threadCount = (argc > 3) ? std::stoi(argv[3]) : std::thread::hardware_concurrency();
+  threadCount = std::max(threadCount, 1u);
+
+  std::vector<std::string> names(CLASSIFIER_BATCH_READS), seqs(CLASSIFIER_BATCH_READS), outputs(CLASSIFIER_BATCH_READS);
+  std::string header, plus, quality;
+  uint64_t totalReads = 0, classifiedReads = 0;
+
+  while(in)
+  {
+    //Read a batch of FASTQ records
+    std::size_t batchSize = 0;
+    while(batchSize < CLASSIFIER_BATCH_READS && std::getline(in, header))
+    {
+      if(header.empty())
+        continue;
+
+      if(header[0] != '@' || !std::getline(in, seqs[batchSize]) || !std::getline(in, plus) || !std::getline(in, quality))
+      {
+        std::cerr << "Malformed FASTQ record after read " << totalReads + batchSize << "\n";
+        return 1;
+      }
+
+      names[batchSize] = header.substr(1, header.find_first_of(" \t") - 1);
+      batchSize++;
+    }
+
+    //Threads classify contiguous ranges of the batch
+    std::vector<std::thread> threads;
+    for(unsigned t = 0; t < threadCount; t++)
+      threads.emplace_back([&, t]() {
+          std::vector<uint64_t> pids;
+          for(std::size_t i = batchSize * t / threadCount; i < batchSize * (t + 1) / threadCount; i++)
+            classifyRead<KmerType>(index, names[i], seqs[i], pids, outputs[i]);
+        });
+    for(auto& thread : threads)
+      thread.join();
+
+    for(std::size_t i = 0; i < batchSize; i++)
+    {
+      std::cout << outputs[i];
+      classifiedReads += (outputs[i][outputs[i].size() - 2] != '*');
+    }
+    totalReads += batchSize;
+  }
+
+  std::cerr << classifiedReads << " of " << totalReads << " reads classified against " << index.kmerCount() << " indexed kmers\n";
+  return 0;
+}
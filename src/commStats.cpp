@@ -0,0 +1,220 @@
+/**
+ * @file    commStats.cpp
+ * @ingroup group
+ * @brief   Counts the communication of the MPI calls through the MPI profiling interface, see commStats.hpp.
+ *          Linked into the executables of builds with METAG_COMM_STATS
+ *
+ * Copyright (c) 2015 Georgia Institute of Technology. All Rights Reserved.
+ */
+
+//Includes
+#include <mpi.h>
+
+//Own includes
+#include "commStats.hpp"
+
+CommCounters& commCounters()
+{
+  static CommCounters counters;
+  return counters;
+}
+
+bool& commCountingPaused()
+{
+  static bool paused = false;
+  return paused;
+}
+
+namespace {
+
+  int typeBytes(MPI_Datatype type)
+  {
+    int bytes = 0;
+    PMPI_Type_size(type, &bytes);
+    return bytes;
+  }
+
+  void addCount(CommKind kind, uint64_t bytes)
+  {
+    if(commCountingPaused())
+      return;
+
+    commCounters().bytes[kind] += bytes;
+    commCounters().calls[kind]++;
+  }
+
+  void rankAndSize(MPI_Comm comm, int& rank, int& p)
+  {
+    PMPI_Comm_rank(comm, &rank);
+    PMPI_Comm_size(comm, &p);
+  }
+}
+
+extern "C" {
+
+int MPI_Send(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm)
+{
+  addCount(COMM_P2P, (uint64_t)count * typeBytes(type));
+  return PMPI_Send(buf, count, type, dest, tag, comm);
+}
+
+int MPI_Ssend(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm)
+{
+  addCount(COMM_P2P, (uint64_t)count * typeBytes(type));
+  return PMPI_Ssend(buf, count, type, dest, tag, comm);
+}
+
+int MPI_Isend(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request* request)
+{
+  addCount(COMM_P2P, (uint64_t)count * typeBytes(type));
+  return PMPI_Isend(buf, count, type, dest, tag, comm, request);
+}
+
+int MPI_Sendrecv(const void* sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag,
+                 void* recvbuf, int recvcount, MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status* status)
+{
+  addCount(COMM_P2P, (uint64_t)sendcount * typeBytes(sendtype));
+  return PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag, recvbuf, recvcount, recvtype, source, recvtag, comm, status);
+}
+
+int MPI_Get(void* origin, int origincount, MPI_Datatype origintype, int target, MPI_Aint targetdisp,
+            int targetcount, MPI_Datatype targettype, MPI_Win win)
+{
+  addCount(COMM_RMA, (uint64_t)origincount * typeBytes(origintype));
+  return PMPI_Get(origin, origincount, origintype, target, targetdisp, targetcount, targettype, win);
+}
+
+int MPI_Fetch_and_op(const void* origin, void* result, MPI_Datatype type, int target, MPI_Aint targetdisp, MPI_Op op, MPI_Win win)
+{
+  addCount(COMM_RMA, typeBytes(type));
+  return PMPI_Fetch_and_op(origin, result, type, target, targetdisp, op, win);
+}
+
+int MPI_Alltoall(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void* recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm)
+{
+  int rank, p;
+  rankAndSize(comm, rank, p);
+  addCount(COMM_ALL2ALL, (uint64_t)sendcount * typeBytes(sendtype) * (p - 1));
+  return PMPI_Alltoall(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+}
+
+int MPI_Alltoallv(const void* sendbuf, const int sendcounts[], const int sdispls[], MPI_Datatype sendtype,
+                  void* recvbuf, const int recvcounts[], const int rdispls[], MPI_Datatype recvtype, MPI_Comm comm)
+{
+  int rank, p;
+  rankAndSize(comm, rank, p);
+
+  uint64_t elements = 0;
+  for(int i = 0; i < p; i++)
+    if(i != rank)
+      elements += sendcounts[i];
+
+  addCount(COMM_ALL2ALL, elements * typeBytes(sendtype));
+  return PMPI_Alltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf, recvcounts, rdispls, recvtype, comm);
+}
+
+int MPI_Allgather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                  void* recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm)
+{
+  int rank, p;
+  rankAndSize(comm, rank, p);
+
+  uint64_t bytes = (sendbuf == MPI_IN_PLACE) ? (uint64_t)recvcount * typeBytes(recvtype) : (uint64_t)sendcount * typeBytes(sendtype);
+  addCount(COMM_ALLGATHER, bytes * (p - 1));
+  return PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+}
+
+int MPI_Allgatherv(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                   void* recvbuf, const int recvcounts[], const int displs[], MPI_Datatype recvtype, MPI_Comm comm)
+{
+  int rank, p;
+  rankAndSize(comm, rank, p);
+
+  uint64_t bytes = (sendbuf == MPI_IN_PLACE) ? (uint64_t)recvcounts[rank] * typeBytes(recvtype) : (uint64_t)sendcount * typeBytes(sendtype);
+  addCount(COMM_ALLGATHER, bytes * (p - 1));
+  return PMPI_Allgatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, comm);
+}
+
+int MPI_Gather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+               void* recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+  int rank, p;
+  rankAndSize(comm, rank, p);
+  addCount(COMM_ALLGATHER, (rank == root) ? 0 : (uint64_t)sendcount * typeBytes(sendtype));
+  return PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+}
+
+int MPI_Gatherv(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                void* recvbuf, const int recvcounts[], const int displs[], MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+  int rank, p;
+  rankAndSize(comm, rank, p);
+  addCount(COMM_ALLGATHER, (rank == root) ? 0 : (uint64_t)sendcount * typeBytes(sendtype));
+  return PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm);
+}
+
+int MPI_Scatter(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                void* recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+  int rank, p;
+  rankAndSize(comm, rank, p);
+  addCount(COMM_ALLGATHER, (rank == root) ? (uint64_t)sendcount * typeBytes(sendtype) * (p - 1) : 0);
+  return PMPI_Scatter(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+}
+
+int MPI_Scatterv(const void* sendbuf, const int sendcounts[], const int displs[], MPI_Datatype sendtype,
+                 void* recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+  int rank, p;
+  rankAndSize(comm, rank, p);
+
+  uint64_t elements = 0;
+  if(rank == root)
+    for(int i = 0; i < p; i++)
+      if(i != rank)
+        elements += sendcounts[i];
+
+  addCount(COMM_ALLGATHER, elements * typeBytes(sendtype));
+  return PMPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount, recvtype, root, comm);
+}
+
+int MPI_Bcast(void* buffer, int count, MPI_Datatype type, int root, MPI_Comm comm)
+{
+  int rank, p;
+  rankAndSize(comm, rank, p);
+  addCount(COMM_BCAST, (rank == root) ? (uint64_t)count * typeBytes(type) * (p - 1) : 0);
+  return PMPI_Bcast(buffer, count, type, root, comm);
+}
+
+int MPI_Reduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op, int root, MPI_Comm comm)
+{
+  addCount(COMM_REDUCE, (uint64_t)count * typeBytes(type));
+  return PMPI_Reduce(sendbuf, recvbuf, count, type, op, root, comm);
+}
+
+int MPI_Allreduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm)
+{
+  addCount(COMM_REDUCE, (uint64_t)count * typeBytes(type));
+  return PMPI_Allreduce(sendbuf, recvbuf, count, type, op, comm);
+}
+
+int MPI_Scan(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm)
+{
+  addCount(COMM_REDUCE, (uint64_t)count * typeBytes(type));
+  return PMPI_Scan(sendbuf, recvbuf, count, type, op, comm);
+}
+
+int MPI_Exscan(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm)
+{
+  addCount(COMM_REDUCE, (uint64_t)count * typeBytes(type));
+  return PMPI_Exscan(sendbuf, recvbuf, count, type, op, comm);
+}
+
+int MPI_Barrier(MPI_Comm comm)
+{
+  addCount(COMM_BARRIER, 0);
+  return PMPI_Barrier(comm);
+}
+
+}
@@ -0,0 +1,129 @@
+/**
+ * @file    extractPartitions.cpp
+ * @ingroup group
+ * @brief   Lists the partitions of a partition store written by metaG --partitionStore,
+ *          or prints the reads of the chosen partitions in FASTA format for an assembler
+ *
+ * Copyright (c) 2015 Georgia Institute of Technology. All Rights Reserved.
+ */
+
+//Includes
+#include <iostream>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//File includes from BLISS
+#include <common/kmer.hpp>
+#include <common/base_types.hpp>
+
+//Own includes
+#include "configParam.hpp"
+#include "packedRead.hpp"
+#include "partitionStore.hpp"
+
+int main(int argc, char** argv)
+{
+  if(argc < 2)
+  {
+    std::cout << "Usage : \n";
+    std::cout << "<executable> <storePrefix>                    Lists pid, read count and kmer count of every partition\n";
+    std::cout << "<executable> <storePrefix> <pid> [<pid> ...]  Prints the reads of the partitions in FASTA format\n";
+    return 1;
+  }
+
+  //Same read storage as during assembly
+  typedef bliss::common::DNA AlphabetType;
+  typedef bliss::common::Kmer<KMER_LEN, AlphabetType, KmerIdType> KmerType;
+  typedef readStorageInfo<typename KmerType::KmerAlphabet, typename KmerType::KmerWordType> ReadSeqTypeInfo;
+  typedef std::array<typename ReadSeqTypeInfo::ReadWordType, ReadSeqTypeInfo::nWords> ReadSeqType;
+
+  PartitionStoreReader store;
+  std::string error;
+  if(!store.open(argv[1], error))
+  {
+    std::cerr << error << "\n";
+    return 1;
+  }
+
+  const PartitionStoreHeader& info = store.info();
+  if(info.bitsPerChar != ReadSeqTypeInfo::bitsPerChar || info.nWords != ReadSeqTypeInfo::nWords
+      || info.wordBytes != sizeof(typename ReadSeqTypeInfo::ReadWordType))
+  {
+    std::cerr << "Read storage of the partition store does not match this build, MAX_READ_SIZE should be " << info.maxReadSize << "\n";
+    return 1;
+  }
+
+  //List the partitions, merging the extents of a partition
+  if(argc == 2)
+  {
+    std::cout << "pid reads kmers\n";
+    for(std::size_t i = 0; i < store.extentCount();)
+    {
+      auto range = store.find(store.extent(i).pid);
+
+      uint64_t reads = 0, kmers = 0;
+      for(std::size_t j = range.first; j < range.second; j++)
+      {
+        reads += store.extent(j).reads;
+        kmers += store.extent(j).kmers;
+      }
+
+      std::cout << store.extent(i).pid << " " << reads << " " << kmers << "\n";
+      i = range.second;
+    }
+    return 0;
+  }
+
+  //Pieces of a split partition share kmers, an assembler would join them again
+  if(argc > 3 && (info.flags & PARTITION_STORE_SPLIT_PIECES))
+    std::cerr << "Partitions of this store may share kmers, assemble them separately\n";
+
+  std::string buffer;
+  ReadSeqType readPacked;
+
+  for(int arg = 2; arg < argc; arg++)
+  {
+    uint64_t pid = std::stoull(argv[arg]);
+    auto range = store.find(pid);
+
+    if(range.first == range.second)
+    {
+      std::cerr << "Partition " << pid << " is not in the store\n";
+      return 1;
+    }
+
+    for(std::size_t j = range.first; j < range.second; j++)
+    {
+      auto extent = store.extent(j);
+      const char* record = store.records(extent);
+
+      if(record == nullptr)
+      {
+        std::cerr << "Reads of partition " << pid << " can not be read from " << partitionStoreReadsFile(argv[1], extent.file) << "\n";
+        return 1;
+      }
+
+      for(uint64_t r = 0; r < extent.reads; r++, record += store.recordBytes())
+      {
+        uint64_t rid;
+        uint32_t length;
+        std::memcpy(&rid, record, sizeof(rid));
+        std::memcpy(&length, record + sizeof(rid), sizeof(length));
+        std::memcpy(readPacked.data(), record + PARTITION_RECORD_PREFIX_BYTES, sizeof(readPacked));
+
+        if(length > ReadSeqTypeInfo::maxCharCount)
+        {
+          std::cerr << "Read " << rid << " of partition " << pid << " is corrupt\n";
+          return 1;
+        }
+
+        buffer.clear();
+        getUnPackedRead<ReadSeqTypeInfo>(readPacked, length, buffer);
+        std::cout << ">" << rid << "\n" << buffer << "\n";
+      }
+    }
+  }
+
+  return 0;
+}
@@ -57,8 +57,8 @@ int main(int argc, char** argv)
   //Assuming kmer-length is less than 32
   typedef uint64_t KmerIdType;
 
-  //Assuming partition count is less than 4 Billion
-  typedef uint32_t partitionIdType;
+  //Wide enough for the partition ids of builds with METAG_64BIT_IDS
+  typedef uint64_t partitionIdType;
 
   std::multimap<partitionIdType, KmerIdType> pid_KmersMap1;
   std::multimap<partitionIdType, KmerIdType> pid_KmersMap2;
@@ -0,0 +1,96 @@
+/**
+ * @file    testPackedRead.cpp
+ * @ingroup group
+ * @brief   Checks the word at a time read packing kernels against the scalar versions, for every read length
+ *          from 0 to MAX_READ_SIZE. Returns non-zero if any read differs
+ *
+ * Copyright (c) 2015 Georgia Institute of Technology. All Rights Reserved.
+ */
+
+//Includes
+#include <array>
+#include <iostream>
+#include <random>
+#include <string>
+
+//File includes from BLISS
+#include <common/kmer.hpp>
+#include <common/base_types.hpp>
+#include <iterators/transform_iterator.hpp>
+
+//Own includes
+#include "configParam.hpp"
+#include "packedRead.hpp"
+
+//Random reads checked for every length
+const int READS_PER_LENGTH = 64;
+
+//Guard characters after the unpacked read, which the kernels should not overwrite
+const std::size_t GUARD_CHARS = 64;
+
+int main()
+{
+  //Same read storage as during assembly
+  typedef bliss::common::DNA AlphabetType;
+  typedef bliss::common::Kmer<KMER_LEN, AlphabetType, KmerIdType> KmerType;
+  typedef readStorageInfo<typename KmerType::KmerAlphabet, typename KmerType::KmerWordType> ReadSeqTypeInfo;
+  typedef std::array<typename ReadSeqTypeInfo::ReadWordType, ReadSeqTypeInfo::nWords> ReadSeqType;
+
+  using BaseCharIterator = bliss::iterator::transform_iterator<std::string::const_iterator, bliss::common::ASCII2<AlphabetType> >;
+
+  std::mt19937_64 gen(12345);
+  std::uniform_int_distribution<int> base(0, 3);
+  const char bases[] = "ACGT";
+
+  uint64_t failures = 0;
+
+  for(std::size_t length = 0; length <= MAX_READ_SIZE; length++)
+  {
+    for(int r = 0; r < READS_PER_LENGTH; r++)
+    {
+      std::string read(length, 'A');
+      for(auto& c : read)
+        c = bases[base(gen)];
+
+      BaseCharIterator start(read.begin(), bliss::common::ASCII2<AlphabetType>());
+      BaseCharIterator end(read.end(), bliss::common::ASCII2<AlphabetType>());
+
+      //Pack
+      ReadSeqType packed = ReadSeqType(), packedScalar = ReadSeqType();
+      getPackedRead<ReadSeqTypeInfo>(packed, start, end);
+      getPackedReadScalar<ReadSeqTypeInfo>(packedScalar, start, end);
+
+      if(packed != packedScalar)
+      {
+        std::cerr << "getPackedRead differs from getPackedReadScalar for read " << read << " of length " << length << "\n";
+        failures++;
+      }
+
+      //Unpack, both from the scalar packing
+      std::string unpacked(length + GUARD_CHARS, '#'), unpackedScalar(length + GUARD_CHARS, '#');
+      getUnPackedRead<ReadSeqTypeInfo>(packedScalar, length, &unpacked[0]);
+      getUnPackedReadScalar<ReadSeqTypeInfo>(packedScalar, length, &unpackedScalar[0]);
+
+      if(unpacked != unpackedScalar || unpacked.compare(0, length, read) != 0
+          || unpacked.find_first_not_of('#', length) != std::string::npos)
+      {
+        std::cerr << "getUnPackedRead gives " << unpacked << ", getUnPackedReadScalar gives " << unpackedScalar
+          << " for read " << read << " of length " << length << "\n";
+        failures++;
+      }
+
+      //Same for the string version
+      std::string unpackedString;
+      getUnPackedRead<ReadSeqTypeInfo>(packed, length, unpackedString);
+      if(unpackedString != read)
+      {
+        std::cerr << "getUnPackedRead to a string gives " << unpackedString << " for read " << read << "\n";
+        failures++;
+      }
+    }
+  }
+
+  std::cout << (failures ? "FAILED" : "PASSED") << " : " << failures << " of " << (MAX_READ_SIZE + 1) * READS_PER_LENGTH
+    << " reads differ, word at a time kernels " << (packedWordKernelsApply<ReadSeqTypeInfo>::value ? "used" : "not used") << "\n";
+  return failures ? 1 : 0;
+}